@@ -0,0 +1,244 @@
+"use strict";
+
+// Stores and compares benchmark results written by the plugin.
+//
+// Every encoder session appends one JSON line to the file named in the
+// OBS_FFMPEG_ENCODER_STATS environment variable. Repeat a benchmark a few
+// times into the same file, then either store it as a baseline:
+//   node ci/benchmark.js save <baseline dir> <machine profile> <name> <results>
+// or compare a new set of runs against a stored baseline:
+//   node ci/benchmark.js compare <baseline dir> <machine profile> <name> <results> [threshold %]
+// The comparison exits with code 1 if any metric regressed beyond the threshold,
+// or if runs in deterministic mode produced different output than the baseline.
+// Runs with a color format of more than 8 bits are kept apart from 8-bit runs, so
+// 10-bit conversion timing has a baseline of its own.
+//
+// Priority classes are checked by recording with a live encoder alone, then again
+// with a saturating encoder at a lower priority running next to it:
+//   node ci/benchmark.js contention <alone results> <loaded results> [threshold %]
+// This exits with code 1 if the encode latency of live encoders grew beyond the
+// threshold (default 10%) under load.
+
+const process = require('process');
+const fs = require('fs');
+const path = require('path');
+
+// Metrics and whether a larger value is an improvement.
+const metrics = {
+	"fps": true,
+	"encode_ms": false,
+	"convert_ms": false,
+	"send_ms": false,
+	"receive_ms": false,
+	"cpu_ms": false,
+	"allocations": false,
+	"first_packet_ms": false,
+	"latency_p50_ms": false,
+	"latency_p99_ms": false,
+};
+
+// Metrics of live encoders that must not suffer from encoders at lower priorities.
+const contention_metrics = ["latency_p50_ms", "latency_p99_ms"];
+
+const bootstrap_samples = 2000;
+const confidence = 0.95;
+
+function loadResults(file) {
+	let groups = {};
+	for (let line of fs.readFileSync(file, 'utf8').split(/\r?\n/)) {
+		if (line.trim() == "")
+			continue;
+		let run = JSON.parse(line);
+		// Live is the default priority and 8 bits the default depth, which older results do not name.
+		let key = `${run.codec} ${run.width}x${run.height}`;
+		if ((run.bits !== undefined) && (run.bits != 8))
+			key += ` ${run.bits}-bit`;
+		if ((run.priority !== undefined) && (run.priority != "Live"))
+			key += ` ${run.priority}`;
+		if (groups[key] === undefined)
+			groups[key] = [];
+		groups[key].push(run);
+	}
+	return groups;
+}
+
+function median(values) {
+	let sorted = values.slice().sort((a, b) => a - b);
+	let mid = Math.floor(sorted.length / 2);
+	if (sorted.length % 2 == 0)
+		return (sorted[mid - 1] + sorted[mid]) / 2;
+	return sorted[mid];
+}
+
+// Deterministic generator, so that a verdict can be reproduced from the same files.
+function random(seed) {
+	let state = seed >>> 0;
+	return function() {
+		state = (state + 0x6D2B79F5) >>> 0;
+		let t = state;
+		t = Math.imul(t ^ (t >>> 15), t | 1);
+		t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+		return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+	};
+}
+
+function resample(values, rng) {
+	let res = [];
+	for (let idx = 0; idx < values.length; idx++)
+		res.push(values[Math.floor(rng() * values.length)]);
+	return res;
+}
+
+// Bootstrap confidence interval of the relative change of the median.
+function compareMedians(base, next) {
+	let base_median = median(base);
+	let next_median = median(next);
+	let rng = random(0x4F424646);
+	let changes = [];
+	for (let idx = 0; idx < bootstrap_samples; idx++) {
+		let b = median(resample(base, rng));
+		let n = median(resample(next, rng));
+		changes.push(b != 0 ? (n - b) / Math.abs(b) : (n == b ? 0 : Infinity));
+	}
+	changes.sort((a, b) => a - b);
+	let tail = (1 - confidence) / 2;
+	return {
+		base: base_median,
+		next: next_median,
+		change: base_median != 0 ? (next_median - base_median) / Math.abs(base_median) : 0,
+		low: changes[Math.floor(tail * (changes.length - 1))],
+		high: changes[Math.ceil((1 - tail) * (changes.length - 1))],
+	};
+}
+
+// Checksums of runs in deterministic mode, which only differ if the output differs.
+function checksums(runs) {
+	return [...new Set(runs.map(run => run.checksum).filter(v => v !== undefined))];
+}
+
+function baselineFile(dir, profile, name) {
+	return path.join(dir, profile, `${name}.jsonl`);
+}
+
+function save(dir, profile, name, results) {
+	let file = baselineFile(dir, profile, name);
+	fs.mkdirSync(path.dirname(file), { recursive: true });
+	fs.copyFileSync(results, file);
+	console.log(`Stored baseline '${name}' for profile '${profile}' in '${file}'.`);
+	return 0;
+}
+
+function compare(dir, profile, name, results, threshold) {
+	let base = loadResults(baselineFile(dir, profile, name));
+	let next = loadResults(results);
+	let regressions = 0;
+
+	for (let key in next) {
+		if (base[key] === undefined) {
+			console.log(`${key}: No baseline, skipped.`);
+			continue;
+		}
+		if ((base[key].length < 3) || (next[key].length < 3)) {
+			console.log(`${key}: At least 3 runs are required on both sides, skipped.`);
+			continue;
+		}
+
+		console.log(`${key}: ${base[key].length} baseline runs, ${next[key].length} new runs.`);
+		let base_sums = checksums(base[key]);
+		let next_sums = checksums(next[key]);
+		if ((base_sums.length > 1) || (next_sums.length > 1)) {
+			console.log(`  output       differs between runs of the same side, not deterministic`);
+		} else if ((base_sums.length == 1) && (next_sums.length == 1)) {
+			let same = base_sums[0] == next_sums[0];
+			console.log(`  output       ${base_sums[0]} -> ${next_sums[0]} ${same ? "identical" : "CHANGED"}`);
+			if (!same)
+				regressions++;
+		}
+		for (let metric in metrics) {
+			let b = base[key].map(run => run[metric]).filter(v => v !== undefined);
+			let n = next[key].map(run => run[metric]).filter(v => v !== undefined);
+			if ((b.length == 0) || (n.length == 0))
+				continue;
+
+			let res = compareMedians(b, n);
+			// A regression is only reported when the whole confidence interval is beyond the threshold.
+			let worse = metrics[metric] ? (res.high < -threshold) : (res.low > threshold);
+			let better = metrics[metric] ? (res.low > threshold) : (res.high < -threshold);
+			let verdict = worse ? "REGRESSION" : (better ? "improvement" : "unchanged");
+			if (worse)
+				regressions++;
+
+			console.log(`  ${metric.padEnd(12)} ${res.base.toFixed(3).padStart(12)} -> ${res.next.toFixed(3).padStart(12)}`
+				+ ` (${(res.change * 100).toFixed(1)}%, ${confidence * 100}% CI ${(res.low * 100).toFixed(1)}%`
+				+ ` to ${(res.high * 100).toFixed(1)}%) ${verdict}`);
+		}
+	}
+
+	if (regressions > 0) {
+		console.log(`${regressions} regression(s) found.`);
+		return 1;
+	}
+	console.log("No regressions found.");
+	return 0;
+}
+
+function contention(alone_file, loaded_file, threshold) {
+	let alone = loadResults(alone_file);
+	let loaded = loadResults(loaded_file);
+	let regressions = 0;
+
+	for (let key in loaded) {
+		if ((loaded[key][0].priority || "Live") != "Live") {
+			console.log(`${key}: ${loaded[key].length} runs providing load.`);
+			continue;
+		}
+		if ((alone[key] === undefined) || (alone[key].length < 3) || (loaded[key].length < 3)) {
+			console.log(`${key}: At least 3 runs alone and under load are required, skipped.`);
+			continue;
+		}
+
+		console.log(`${key}: ${alone[key].length} runs alone, ${loaded[key].length} runs under load.`);
+		for (let metric of contention_metrics) {
+			let a = alone[key].map(run => run[metric]).filter(v => v !== undefined);
+			let l = loaded[key].map(run => run[metric]).filter(v => v !== undefined);
+			if ((a.length == 0) || (l.length == 0))
+				continue;
+
+			let res = compareMedians(a, l);
+			let worse = res.low > threshold;
+			if (worse)
+				regressions++;
+			console.log(`  ${metric.padEnd(16)} ${res.base.toFixed(3).padStart(10)} -> ${res.next.toFixed(3).padStart(10)}`
+				+ ` (${(res.change * 100).toFixed(1)}%, ${confidence * 100}% CI ${(res.low * 100).toFixed(1)}%`
+				+ ` to ${(res.high * 100).toFixed(1)}%) ${worse ? "SLOWER UNDER LOAD" : "unaffected"}`);
+		}
+	}
+
+	if (regressions > 0) {
+		console.log(`${regressions} live latency metric(s) suffer from lower priority encoders.`);
+		return 1;
+	}
+	console.log("Live encoders keep their latency under load.");
+	return 0;
+}
+
+let args = process.argv.slice(2);
+try {
+	if ((args[0] == "save") && (args.length == 5)) {
+		process.exit(save(args[1], args[2], args[3], args[4]));
+	} else if ((args[0] == "compare") && (args.length >= 5)) {
+		let threshold = (args.length > 5 ? parseFloat(args[5]) : 5) / 100;
+		process.exit(compare(args[1], args[2], args[3], args[4], threshold));
+	} else if ((args[0] == "contention") && (args.length >= 3)) {
+		let threshold = (args.length > 3 ? parseFloat(args[3]) : 10) / 100;
+		process.exit(contention(args[1], args[2], threshold));
+	}
+	console.log("Usage:");
+	console.log("  node ci/benchmark.js save <baseline dir> <machine profile> <name> <results>");
+	console.log("  node ci/benchmark.js compare <baseline dir> <machine profile> <name> <results> [threshold %]");
+	console.log("  node ci/benchmark.js contention <alone results> <loaded results> [threshold %]");
+	process.exit(2);
+} catch (e) {
+	console.log(e);
+	process.exit(2);
+}
@@ -0,0 +1,190 @@
+"use strict";
+
+// Replays a packet trace through a simulated network link.
+//
+// Set OBS_FFMPEG_ENCODER_TRACE to a path prefix before starting OBS Studio,
+// and every encoder writes one JSON line per packet to
+// "<prefix>-<encoder name>-<id>.jsonl". This script feeds such a trace at its
+// original rate into a send buffer drained by a link with the given
+// bandwidth, jitter, loss and buffer size, applies the same kind of
+// priority based dropping that OBS Studio outputs do, and reports latency,
+// drops per priority class and how long it takes to recover from congestion.
+//
+// Usage:
+//   node ci/netsim.js <trace> [options]
+// Options:
+//   --bandwidth=<kbit/s>           Link bandwidth (default 6000).
+//   --congestion=<s>:<s>:<kbit/s>  Bandwidth during a time range, can be repeated.
+//   --rtt=<ms>                     Round trip time (default 50).
+//   --jitter=<ms>                  Maximum additional one-way delay (default 10).
+//   --loss=<%>                     Packet loss, each loss costs one round trip (default 0).
+//   --buffer=<KiB>                 Send buffer size (default 4096).
+//   --threshold=<ms>               Queue delay at which disposable frames are dropped (default 700).
+//   --pframe-threshold=<ms>        Queue delay at which all frames up to the next keyframe are dropped
+//                                  (default 900).
+//   --seed=<n>                     Random seed (default 1).
+
+const process = require('process');
+const fs = require('fs');
+
+function parseArgs(argv) {
+	let opts = {
+		trace: undefined,
+		bandwidth: 6000,
+		congestion: [],
+		rtt: 50,
+		jitter: 10,
+		loss: 0,
+		buffer: 4096,
+		threshold: 700,
+		pframe_threshold: 900,
+		seed: 1,
+	};
+	for (let arg of argv) {
+		let m = arg.match(/^--([a-z-]+)=(.*)$/);
+		if (!m) {
+			opts.trace = arg;
+			continue;
+		}
+		if (m[1] == "congestion") {
+			let parts = m[2].split(":").map(parseFloat);
+			opts.congestion.push({ start: parts[0] * 1000, end: parts[1] * 1000, bandwidth: parts[2] });
+		} else if (opts[m[1].replace(/-/g, "_")] !== undefined) {
+			opts[m[1].replace(/-/g, "_")] = parseFloat(m[2]);
+		} else {
+			throw new Error(`Unknown option '${m[1]}'.`);
+		}
+	}
+	if (opts.trace === undefined)
+		throw new Error("No trace given.");
+	return opts;
+}
+
+function random(seed) {
+	let state = seed >>> 0;
+	return function() {
+		state = (state + 0x6D2B79F5) >>> 0;
+		let t = state;
+		t = Math.imul(t ^ (t >>> 15), t | 1);
+		t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+		return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+	};
+}
+
+function percentile(sorted, p) {
+	if (sorted.length == 0)
+		return 0;
+	return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+}
+
+function bandwidthAt(opts, time) {
+	for (let c of opts.congestion) {
+		if ((time >= c.start) && (time < c.end))
+			return c.bandwidth;
+	}
+	return opts.bandwidth;
+}
+
+function simulate(opts) {
+	let rng = random(opts.seed);
+	let packets = fs.readFileSync(opts.trace, 'utf8').split(/\r?\n/).filter(l => l.trim() != "").map(l => JSON.parse(l));
+	if (packets.length == 0)
+		throw new Error("Trace is empty.");
+
+	// Packets are replayed at the time the encoder returned them. Presentation timestamps are out of order
+	// with B-frames, so they are no measure of when a packet arrives.
+	let first_time = packets[0].time;
+	let arrival = (p) => p.time - first_time;
+
+	let link_free = 0;      // Time at which the link finishes sending everything queued so far.
+	let queue = [];         // Departure time and size of packets still in the send buffer.
+	let queued_bytes = 0;
+	let wait_keyframe = false;
+	let latencies = [];
+	let drops = {};
+	let sent = {};
+	let events = [];
+	let event = undefined;
+
+	for (let p of packets) {
+		let now = arrival(p);
+		while ((queue.length > 0) && (queue[0].departure <= now)) {
+			queued_bytes -= queue.shift().size;
+		}
+
+		let delay = Math.max(0, link_free - now);
+		let cls = p.keyframe ? "keyframe" : `priority ${p.priority}`;
+
+		// Track congestion events from the first time the threshold is hit until the queue has drained to half of it.
+		if ((event === undefined) && (delay > opts.threshold)) {
+			event = { start: now, end: undefined };
+		} else if ((event !== undefined) && (delay < opts.threshold / 2)) {
+			event.end = now;
+			events.push(event);
+			event = undefined;
+		}
+
+		// Dropping policy: disposable frames (drop priority 0) go first, at the lower threshold. Dropping any
+		// other frame breaks the reference chain, so everything up to the next keyframe has to go with it.
+		let drop = false;
+		if (p.keyframe) {
+			wait_keyframe = false;
+		} else if (wait_keyframe) {
+			drop = true;
+		} else if ((delay > opts.pframe_threshold) || (queued_bytes + p.size > opts.buffer * 1024)) {
+			drop = true;
+			if (p.priority > 0)
+				wait_keyframe = true;
+		} else if ((delay > opts.threshold) && (p.priority == 0)) {
+			drop = true;
+		}
+		if (drop) {
+			drops[cls] = (drops[cls] || 0) + 1;
+			continue;
+		}
+		sent[cls] = (sent[cls] || 0) + 1;
+
+		// Transmission, with each lost attempt costing a round trip before the retransmission.
+		let start = Math.max(now, link_free);
+		let duration = p.size * 8 / bandwidthAt(opts, start); // kbit/s equals bit/ms.
+		while ((opts.loss > 0) && (rng() < opts.loss / 100))
+			duration += opts.rtt;
+		link_free = start + duration;
+		queue.push({ departure: link_free, size: p.size });
+		queued_bytes += p.size;
+
+		let delivery = link_free + opts.rtt / 2 + rng() * opts.jitter;
+		latencies.push(delivery - now);
+	}
+	if (event !== undefined)
+		events.push(event);
+
+	latencies.sort((a, b) => a - b);
+	return { packets: packets.length, latencies, drops, sent, events };
+}
+
+try {
+	let opts = parseArgs(process.argv.slice(2));
+	let res = simulate(opts);
+
+	console.log(`Packets: ${res.packets}`);
+	console.log(`Latency: p50 ${percentile(res.latencies, 0.5).toFixed(1)} ms, p95 ${percentile(res.latencies, 0.95).toFixed(1)} ms,`
+		+ ` p99 ${percentile(res.latencies, 0.99).toFixed(1)} ms, max ${percentile(res.latencies, 1).toFixed(1)} ms`);
+	let classes = new Set(Object.keys(res.sent).concat(Object.keys(res.drops)));
+	for (let cls of Array.from(classes).sort()) {
+		let dropped = res.drops[cls] || 0;
+		let total = dropped + (res.sent[cls] || 0);
+		console.log(`Dropped ${cls}: ${dropped} of ${total} (${(dropped * 100 / total).toFixed(1)}%)`);
+	}
+	for (let e of res.events) {
+		if (e.end === undefined) {
+			console.log(`Congestion at ${(e.start / 1000).toFixed(2)} s: did not recover`);
+		} else {
+			console.log(`Congestion at ${(e.start / 1000).toFixed(2)} s: recovered after ${((e.end - e.start) / 1000).toFixed(2)} s`);
+		}
+	}
+	process.exit(0);
+} catch (e) {
+	console.log(e.message);
+	process.exit(1);
+}
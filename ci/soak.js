@@ -0,0 +1,151 @@
+"use strict";
+
+// Checks soak test samples for growth over time.
+//
+// Set OBS_FFMPEG_ENCODER_SOAK to a file path before starting OBS Studio, and
+// every encoder appends a sample of process memory, allocator state, frame
+// pool sizes and encode latency percentiles to it every 10 seconds. Setting
+// OBS_FFMPEG_ENCODER_SOAK_CHURN to a frame count additionally rebuilds each
+// encoder after that many frames, which compresses days of settings updates
+// into hours. Restarting encoders and changing the canvas resolution during
+// the run is up to whatever drives OBS Studio.
+//
+// This script fits a line through every metric after the warm-up, and fails
+// if any of them grows by more than the threshold per hour with a good fit,
+// as a steady trend is what a leak or fragmentation looks like, while noise
+// and sawtooth patterns from caches are not.
+//
+// Usage:
+//   node ci/soak.js <samples> [options]
+// Options:
+//   --warmup=<s>     Ignore samples from the first seconds of the run and of each encoder (default 300).
+//   --threshold=<%>  Allowed growth per hour, relative to the average (default 2).
+//   --fit=<r2>       Minimum coefficient of determination for a trend to count (default 0.5).
+
+const process = require('process');
+const fs = require('fs');
+
+// Metrics of the whole process, and whether growth in them is a failure.
+const process_metrics = {
+	"resident": true,
+	"heap_used": true,
+	"heap_free": true,
+	"fragmentation": true,
+};
+
+// Metrics of a single encoder.
+const encoder_metrics = {
+	"free_frames": true,
+	"used_frames": true,
+	"pending_packets": true,
+	"latency_p50": true,
+	"latency_p99": true,
+	"latency_max": false,
+};
+
+function parseArgs(argv) {
+	let opts = {
+		samples: undefined,
+		warmup: 300,
+		threshold: 2,
+		fit: 0.5,
+	};
+	for (let arg of argv) {
+		let m = arg.match(/^--([a-z]+)=(.*)$/);
+		if (!m) {
+			opts.samples = arg;
+			continue;
+		}
+		if (opts[m[1]] !== undefined) {
+			opts[m[1]] = parseFloat(m[2]);
+		} else {
+			throw new Error(`Unknown option '${m[1]}'.`);
+		}
+	}
+	if (opts.samples === undefined)
+		throw new Error("No samples given.");
+	return opts;
+}
+
+// Least squares line through the points, with the coefficient of determination.
+function regression(points) {
+	let n = points.length;
+	let mx = points.reduce((a, p) => a + p.x, 0) / n;
+	let my = points.reduce((a, p) => a + p.y, 0) / n;
+	let sxx = 0, sxy = 0, syy = 0;
+	for (let p of points) {
+		sxx += (p.x - mx) * (p.x - mx);
+		sxy += (p.x - mx) * (p.y - my);
+		syy += (p.y - my) * (p.y - my);
+	}
+	let slope = sxx > 0 ? sxy / sxx : 0;
+	let r2 = (sxx > 0 && syy > 0) ? (sxy * sxy) / (sxx * syy) : 0;
+	return { mean: my, slope, r2 };
+}
+
+function check(name, samples, metrics, opts) {
+	let failures = 0;
+	if (samples.length < 10) {
+		console.log(`${name}: At least 10 samples after the warm-up are required, skipped.`);
+		return 0;
+	}
+	let hours = (samples[samples.length - 1].time - samples[0].time) / 3600;
+	console.log(`${name}: ${samples.length} samples over ${hours.toFixed(2)} hours.`);
+
+	for (let metric in metrics) {
+		let points = samples.filter(s => s[metric] !== undefined).map(s => ({ x: s.time / 3600, y: s[metric] }));
+		if (points.length < 10)
+			continue;
+
+		// Small counters like pool sizes are compared against at least 1, so that going from 0 to 1 once is
+		// not an infinite growth rate. This also puts fragmentation, a ratio, in percentage points.
+		let res = regression(points);
+		let growth = res.slope / Math.max(Math.abs(res.mean), 1) * 100;
+		let grows = (growth > opts.threshold) && (res.r2 >= opts.fit);
+		let verdict = grows ? (metrics[metric] ? "GROWTH" : "growth (informational)") : "stable";
+		if (grows && metrics[metric])
+			failures++;
+
+		console.log(`  ${metric.padEnd(16)} average ${res.mean.toFixed(3).padStart(16)},`
+			+ ` ${growth >= 0 ? "+" : ""}${growth.toFixed(2)}%/h, r2 ${res.r2.toFixed(2)} ${verdict}`);
+	}
+	return failures;
+}
+
+try {
+	let opts = parseArgs(process.argv.slice(2));
+	let samples = fs.readFileSync(opts.samples, 'utf8').split(/\r?\n/).filter(l => l.trim() != "").map(l => JSON.parse(l));
+	if (samples.length == 0)
+		throw new Error("No samples found.");
+	samples.sort((a, b) => a.time - b.time);
+
+	// Memory belongs to the process, so it is checked across all encoders and restarts.
+	let start = samples[0].time;
+	for (let s of samples) {
+		if ((s.heap_used + s.heap_free) > 0)
+			s.fragmentation = s.heap_free / (s.heap_used + s.heap_free);
+	}
+	let failures = check("Process", samples.filter(s => s.time >= start + opts.warmup), process_metrics, opts);
+
+	let encoders = {};
+	for (let s of samples) {
+		if (s.uptime < opts.warmup)
+			continue;
+		if (encoders[s.encoder] === undefined)
+			encoders[s.encoder] = [];
+		encoders[s.encoder].push(s);
+	}
+	for (let name of Object.keys(encoders).sort()) {
+		failures += check(name, encoders[name], encoder_metrics, opts);
+	}
+
+	if (failures > 0) {
+		console.log(`${failures} metric(s) keep growing.`);
+		process.exit(1);
+	}
+	console.log("No growth found.");
+	process.exit(0);
+} catch (e) {
+	console.log(e.message);
+	process.exit(2);
+}
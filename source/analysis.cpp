@@ -0,0 +1,166 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "analysis.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Size of the blocks that are averaged into the analysis grid, in pixels.
+#define ST_BLOCK_SIZE 16
+// Motion, on top of the recent average, at which a frame is considered to start a new scene.
+#define ST_SCENE_CHANGE_THRESHOLD 24.0
+
+obsffmpeg::analysis::analysis(video_t* video, video_format format, uint32_t width, uint32_t height)
+    : _video(video), _format(format), _width(width), _height(height), _motion_average(0)
+{}
+
+obsffmpeg::analysis::~analysis() {}
+
+std::shared_ptr<const obsffmpeg::analysis_result>
+    obsffmpeg::analysis::analyze(const uint8_t* const data[], const uint32_t linesize[])
+{
+	// Timestamps count from the start of each encoder, so they can not tell frames apart across encoders. The
+	// video output hands the same frame to all of them before it counts the next one. Frame buffers are not
+	// compared, as encoders scaled to the same size each get an identical frame in their own buffer.
+	uint64_t frame = static_cast<uint64_t>(video_output_get_total_frames(_video));
+
+	std::unique_lock<std::mutex> ul(_lock);
+	if (_last && (_last->frame == frame))
+		return _last;
+
+	// Luma, or an approximation of it, from the first plane.
+	size_t step   = 1;
+	size_t offset = 0;
+	bool   rgb    = false;
+	switch (_format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_I444:
+	case VIDEO_FORMAT_I422:
+	case VIDEO_FORMAT_Y800:
+	case VIDEO_FORMAT_I40A:
+	case VIDEO_FORMAT_I42A:
+	case VIDEO_FORMAT_YUVA:
+		break;
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_YVYU:
+		step = 2;
+		break;
+	case VIDEO_FORMAT_UYVY:
+		step   = 2;
+		offset = 1;
+		break;
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		step = 4;
+		rgb  = true;
+		break;
+	default:
+		return nullptr;
+	}
+
+	auto result       = std::make_shared<analysis_result>();
+	result->frame     = frame;
+	result->width     = std::max<uint32_t>(_width / ST_BLOCK_SIZE, 1);
+	result->height    = std::max<uint32_t>(_height / ST_BLOCK_SIZE, 1);
+	result->luma.resize(static_cast<size_t>(result->width) * result->height);
+
+	// Every other row is enough for block averages, and halves the memory traffic.
+	uint32_t block_w = _width / result->width;
+	uint32_t block_h = _height / result->height;
+	for (uint32_t by = 0; by < result->height; by++) {
+		for (uint32_t bx = 0; bx < result->width; bx++) {
+			uint64_t sum     = 0;
+			uint32_t samples = 0;
+			for (uint32_t y = by * block_h; y < (by + 1) * block_h; y += 2) {
+				const uint8_t* row = data[0] + static_cast<size_t>(y) * linesize[0];
+				for (uint32_t x = bx * block_w; x < (bx + 1) * block_w; x++) {
+					const uint8_t* px = row + x * step + offset;
+					sum += rgb ? ((px[0] + 2 * px[1] + px[2]) >> 2) : px[0];
+				}
+				samples += block_w;
+			}
+			result->luma[static_cast<size_t>(by) * result->width + bx] =
+			    static_cast<uint8_t>(samples ? (sum / samples) : 0);
+		}
+	}
+
+	// Spatial complexity from horizontal and vertical neighbours.
+	uint64_t activity = 0;
+	for (uint32_t by = 0; by < result->height; by++) {
+		for (uint32_t bx = 0; bx < result->width; bx++) {
+			int v = result->luma[static_cast<size_t>(by) * result->width + bx];
+			if (bx + 1 < result->width)
+				activity +=
+				    std::abs(v - result->luma[static_cast<size_t>(by) * result->width + bx + 1]);
+			if (by + 1 < result->height)
+				activity +=
+				    std::abs(v - result->luma[static_cast<size_t>(by + 1) * result->width + bx]);
+		}
+	}
+	result->complexity = static_cast<double_t>(activity) / (2.0 * result->luma.size());
+
+	// Motion against the previous frame, and a scene change if it is far above what is usual.
+	result->motion       = 0;
+	result->scene_change = false;
+	if (_last && (_last->luma.size() == result->luma.size())) {
+		uint64_t diff = 0;
+		for (size_t idx = 0; idx < result->luma.size(); idx++) {
+			diff += std::abs(result->luma[idx] - _last->luma[idx]);
+		}
+		result->motion       = static_cast<double_t>(diff) / result->luma.size();
+		result->scene_change = (result->motion > (_motion_average + ST_SCENE_CHANGE_THRESHOLD));
+		_motion_average      = _motion_average * 0.9 + result->motion * 0.1;
+	}
+
+	_last = result;
+	return result;
+}
+
+std::shared_ptr<obsffmpeg::analysis> obsffmpeg::analysis::get(video_t* video, video_format format, uint32_t width,
+                                                              uint32_t height)
+{
+	static std::mutex lock;
+	static std::map<std::tuple<video_t*, video_format, uint32_t, uint32_t>, std::weak_ptr<analysis>> instances;
+
+	std::unique_lock<std::mutex> ul(lock);
+	auto                         key   = std::make_tuple(video, format, width, height);
+	auto                         found = instances.find(key);
+	if (found != instances.end()) {
+		if (auto instance = found->second.lock())
+			return instance;
+	}
+
+	// Forget sources nobody uses anymore.
+	for (auto iter = instances.begin(); iter != instances.end();) {
+		if (iter->second.expired()) {
+			iter = instances.erase(iter);
+		} else {
+			iter++;
+		}
+	}
+
+	auto instance  = std::make_shared<analysis>(video, format, width, height);
+	instances[key] = instance;
+	return instance;
+}
@@ -0,0 +1,71 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+#include <obs.h>
+}
+
+namespace obsffmpeg {
+	struct analysis_result {
+		uint64_t             frame;      // Frame counter of the video output.
+		uint32_t             width;      // Width of the block grid.
+		uint32_t             height;     // Height of the block grid.
+		std::vector<uint8_t> luma;       // Average luma of every block.
+		double_t             motion;     // Mean absolute difference to the previous frame, 0 to 255.
+		double_t             complexity; // Mean absolute difference between neighbouring blocks, 0 to 255.
+		bool                 scene_change;
+	};
+
+	// Analyses every frame of a source once, no matter how many encoders consume it. Encoders that
+	// receive the same frames from OBS (same output, size and format) share one instance.
+	class analysis {
+		video_t*     _video;
+		video_format _format;
+		uint32_t     _width;
+		uint32_t     _height;
+
+		std::mutex                             _lock;
+		std::shared_ptr<const analysis_result> _last;
+		double_t                               _motion_average;
+
+		public:
+		analysis(video_t* video, video_format format, uint32_t width, uint32_t height);
+		~analysis();
+
+		// Returns the analysis of the frame the video output currently hands to its encoders, computing it if
+		// this is the first encoder to ask. Must be called from the encode call of a raw video encoder.
+		// Returns nullptr for formats without a usable luma channel.
+		std::shared_ptr<const analysis_result> analyze(const uint8_t* const data[], const uint32_t linesize[]);
+
+		public:
+		static std::shared_ptr<analysis> get(video_t* video, video_format format, uint32_t width,
+		                                     uint32_t height);
+	};
+} // namespace obsffmpeg
@@ -20,6 +20,11 @@
 // SOFTWARE.
 
 #include "encoder.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <set>
 #include <sstream>
@@ -28,9 +33,11 @@
 #include <util/profiler.hpp>
 #include <vector>
 #include "codecs/hevc.hpp"
+#include "analysis.hpp"
 #include "ffmpeg/tools.hpp"
 #include "plugin.hpp"
 #include "strings.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 
 extern "C" {
@@ -39,8 +46,10 @@ extern "C" {
 #pragma warning(push)
 #pragma warning(disable : 4244)
 #include <libavcodec/avcodec.h>
+#include <libavutil/crc.h>
 #include <libavutil/dict.h>
 #include <libavutil/frame.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #pragma warning(pop)
@@ -65,9 +74,81 @@ extern "C" {
 #define ST_FFMPEG_COLORFORMAT "FFmpeg.ColorFormat"
 #define ST_FFMPEG_STANDARDCOMPLIANCE "FFmpeg.StandardCompliance"
 #define ST_FFMPEG_GPU "FFmpeg.GPU"
+#define ST_FFMPEG_PRIORITY "FFmpeg.Priority"
+#define ST_FFMPEG_PRIORITY_(x) "FFmpeg.Priority." D_VSTR(x)
+#define ST_FFMPEG_DECIMATION "FFmpeg.Decimation"
+#define ST_FFMPEG_CONVERTER "FFmpeg.Converter"
+#define ST_FFMPEG_INCREMENTAL "FFmpeg.Incremental"
+#define ST_FFMPEG_SCENECUT "FFmpeg.SceneCut"
+#define ST_FFMPEG_FRAMEPARALLEL "FFmpeg.FrameParallel"
+#define ST_FFMPEG_SHADOW "FFmpeg.Shadow"
+#define ST_FFMPEG_THUMBNAIL "FFmpeg.Thumbnail"
+#define ST_FFMPEG_THUMBNAIL_INTERVAL "FFmpeg.Thumbnail.Interval"
+#define ST_FFMPEG_THUMBNAIL_WIDTH "FFmpeg.Thumbnail.Width"
+#define ST_FFMPEG_FAILOVER "FFmpeg.Failover"
+#define ST_FFMPEG_FASTSTART "FFmpeg.FastStart"
+#define ST_FFMPEG_LOADSHEDDING "FFmpeg.LoadShedding"
+#define ST_FFMPEG_FRAMETAP "FFmpeg.FrameTap"
+#define ST_FFMPEG_FRAMETAP_INTERVAL "FFmpeg.FrameTap.Interval"
+#define ST_FFMPEG_PACKETBUS "FFmpeg.PacketBus"
+
+// Path of a file that receives a JSON summary of every encoder session, used for benchmarking.
+#define ST_ENV_STATS "OBS_FFMPEG_ENCODER_STATS"
+// Path prefix for per-packet traces, which can be replayed through ci/netsim.js.
+#define ST_ENV_TRACE "OBS_FFMPEG_ENCODER_TRACE"
+// Path of a file that receives periodic health samples of every encoder, checked by ci/soak.js.
+#define ST_ENV_SOAK "OBS_FFMPEG_ENCODER_SOAK"
+// Number of frames after which soak runs rebuild the encoder, like a settings update would.
+#define ST_ENV_SOAK_CHURN "OBS_FFMPEG_ENCODER_SOAK_CHURN"
+// Codec thread count for benchmark runs that must produce identical output, enables deterministic mode.
+#define ST_ENV_DETERMINISTIC "OBS_FFMPEG_ENCODER_DETERMINISTIC"
+
+// Encode latency histogram for the statistics file, in 0.1 ms steps up to 200 ms.
+#define ST_LATENCY_STEP 100000
+#define ST_LATENCY_STEPS 2000
 
 enum class keyframe_type { SECONDS, FRAMES };
 
+class wall_time_scope {
+	uint64_t&                                      _counter;
+	std::chrono::high_resolution_clock::time_point _begin;
+
+	public:
+	wall_time_scope(uint64_t& counter) : _counter(counter), _begin(std::chrono::high_resolution_clock::now()) {}
+	~wall_time_scope()
+	{
+		_counter += elapsed();
+	}
+
+	uint64_t elapsed()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		                                 std::chrono::high_resolution_clock::now() - _begin)
+		                                 .count());
+	}
+};
+
+// Start of a duration only a tracer gets to see, so the clock is only read while one is attached.
+class trace_time {
+	std::chrono::high_resolution_clock::time_point _begin;
+
+	public:
+	trace_time(bool enabled)
+	    : _begin(enabled ? std::chrono::high_resolution_clock::now()
+	                     : std::chrono::high_resolution_clock::time_point())
+	{}
+
+	// Zero if no tracer was attached at the start.
+	uint64_t elapsed()
+	{
+		if (_begin == std::chrono::high_resolution_clock::time_point())
+			return 0;
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		                                 std::chrono::high_resolution_clock::now() - _begin)
+		                                 .count());
+	}
+};
+
 static void* _create(obs_data_t* settings, obs_encoder_t* encoder) noexcept
 try {
 #ifdef DEBUG_CALL_ORDER
@@ -336,6 +417,42 @@ try {
 	return false;
 }
 
+static int _execute(AVCodecContext* context, int (*func)(AVCodecContext* c2, void* arg), void* arg, int* ret,
+                    int count, int size) noexcept
+try {
+	reinterpret_cast<obsffmpeg::encoder*>(context->opaque)
+	    ->execute(static_cast<size_t>(count), [context, func, arg, ret, size](size_t job, size_t) {
+		    int res = func(context, reinterpret_cast<uint8_t*>(arg) + job * size);
+		    if (ret)
+			    ret[job] = res;
+	    });
+	return 0;
+} catch (const std::exception& ex) {
+	PLOG_ERROR("Unexpected exception in function '%s': %s.", __FUNCTION_NAME__, ex.what());
+	return AVERROR_BUG;
+} catch (...) {
+	PLOG_ERROR("Unexpected exception in function '%s'.", __FUNCTION_NAME__);
+	return AVERROR_BUG;
+}
+
+static int _execute2(AVCodecContext* context, int (*func)(AVCodecContext* c2, void* arg, int jobnr, int threadnr),
+                     void* arg, int* ret, int count) noexcept
+try {
+	reinterpret_cast<obsffmpeg::encoder*>(context->opaque)
+	    ->execute(static_cast<size_t>(count), [context, func, arg, ret](size_t job, size_t thread) {
+		    int res = func(context, arg, static_cast<int>(job), static_cast<int>(thread));
+		    if (ret)
+			    ret[job] = res;
+	    });
+	return 0;
+} catch (const std::exception& ex) {
+	PLOG_ERROR("Unexpected exception in function '%s': %s.", __FUNCTION_NAME__, ex.what());
+	return AVERROR_BUG;
+} catch (...) {
+	PLOG_ERROR("Unexpected exception in function '%s'.", __FUNCTION_NAME__);
+	return AVERROR_BUG;
+}
+
 obsffmpeg::encoder_factory::encoder_factory(const AVCodec* codec) : avcodec_ptr(codec), info(), info_fallback()
 {
 	// Find Codec UI handler.
@@ -486,8 +603,25 @@ void obsffmpeg::encoder_factory::get_defaults(obs_data_t* settings, bool hw_enco
 			                         static_cast<int64_t>(AV_PIX_FMT_NONE));
 			obs_data_set_default_int(settings, ST_FFMPEG_THREADS, 0);
 			obs_data_set_default_int(settings, ST_FFMPEG_GPU, 0);
+			obs_data_set_default_string(settings, ST_FFMPEG_CONVERTER, "");
+			obs_data_set_default_bool(settings, ST_FFMPEG_INCREMENTAL, false);
+			obs_data_set_default_bool(settings, ST_FFMPEG_SCENECUT, false);
+			obs_data_set_default_int(settings, ST_FFMPEG_FRAMEPARALLEL, 0);
+			obs_data_set_default_string(settings, ST_FFMPEG_SHADOW, "");
+			obs_data_set_default_string(settings, ST_FFMPEG_THUMBNAIL, "");
+			obs_data_set_default_double(settings, ST_FFMPEG_THUMBNAIL_INTERVAL, 5.0);
+			obs_data_set_default_int(settings, ST_FFMPEG_THUMBNAIL_WIDTH, 320);
+			obs_data_set_default_string(settings, ST_FFMPEG_FAILOVER, "");
+			obs_data_set_default_string(settings, ST_FFMPEG_FRAMETAP, "");
+			obs_data_set_default_int(settings, ST_FFMPEG_FRAMETAP_INTERVAL, 30);
 		}
 		obs_data_set_default_int(settings, ST_FFMPEG_STANDARDCOMPLIANCE, FF_COMPLIANCE_STRICT);
+		obs_data_set_default_int(settings, ST_FFMPEG_PRIORITY,
+		                         static_cast<int64_t>(obsffmpeg::thread_priority::LIVE));
+		obs_data_set_default_int(settings, ST_FFMPEG_DECIMATION, 1);
+		obs_data_set_default_bool(settings, ST_FFMPEG_FASTSTART, false);
+		obs_data_set_default_bool(settings, ST_FFMPEG_LOADSHEDDING, true);
+		obs_data_set_default_string(settings, ST_FFMPEG_PACKETBUS, "");
 	}
 }
 
@@ -581,6 +715,76 @@ void obsffmpeg::encoder_factory::get_properties(obs_properties_t* props, bool hw
 				                                  0, std::thread::hardware_concurrency() * 2, 1);
 				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_THREADS)));
 			}
+			if (ffmpeg::frame_parallel::is_supported(avcodec_ptr)) {
+				auto p = obs_properties_add_int_slider(grp, ST_FFMPEG_FRAMEPARALLEL,
+				                                       TRANSLATE(ST_FFMPEG_FRAMEPARALLEL), 0,
+				                                       std::thread::hardware_concurrency(), 1);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_FRAMEPARALLEL)));
+			}
+			{
+				auto p = obs_properties_add_text(grp, ST_FFMPEG_SHADOW, TRANSLATE(ST_FFMPEG_SHADOW),
+				                                 obs_text_type::OBS_TEXT_DEFAULT);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_SHADOW)));
+			}
+			{
+				auto p =
+				    obs_properties_add_list(grp, ST_FFMPEG_CONVERTER, TRANSLATE(ST_FFMPEG_CONVERTER),
+				                            OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_CONVERTER)));
+				obs_property_list_add_string(p, TRANSLATE(S_STATE_AUTOMATIC), "");
+				for (auto& backend : ffmpeg::converter::get_backends()) {
+					obs_property_list_add_string(p, backend.c_str(), backend.c_str());
+				}
+			}
+			{
+				auto p = obs_properties_add_bool(grp, ST_FFMPEG_INCREMENTAL,
+				                                 TRANSLATE(ST_FFMPEG_INCREMENTAL));
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_INCREMENTAL)));
+			}
+			{
+				auto p =
+				    obs_properties_add_bool(grp, ST_FFMPEG_SCENECUT, TRANSLATE(ST_FFMPEG_SCENECUT));
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_SCENECUT)));
+			}
+			{
+				auto p = obs_properties_add_path(grp, ST_FFMPEG_THUMBNAIL,
+				                                 TRANSLATE(ST_FFMPEG_THUMBNAIL), OBS_PATH_FILE_SAVE,
+				                                 "JPEG (*.jpg)", nullptr);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_THUMBNAIL)));
+			}
+			{
+				auto p = obs_properties_add_float(grp, ST_FFMPEG_THUMBNAIL_INTERVAL,
+				                                  TRANSLATE(ST_FFMPEG_THUMBNAIL_INTERVAL), 0.1, 3600.0,
+				                                  0.1);
+				obs_property_float_set_suffix(p, " seconds");
+			}
+			{
+				auto p = obs_properties_add_int(grp, ST_FFMPEG_THUMBNAIL_WIDTH,
+				                                TRANSLATE(ST_FFMPEG_THUMBNAIL_WIDTH), 16, 1920, 2);
+				obs_property_int_set_suffix(p, " pixels");
+			}
+			{
+				auto p = obs_properties_add_list(grp, ST_FFMPEG_FAILOVER, TRANSLATE(ST_FFMPEG_FAILOVER),
+				                                 OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_FAILOVER)));
+				obs_property_list_add_string(p, TRANSLATE(S_STATE_DISABLED), "");
+				for (auto cdc : ffmpeg::tools::get_encoders(avcodec_ptr->id)) {
+					if (cdc == avcodec_ptr)
+						continue;
+					obs_property_list_add_string(p, cdc->long_name ? cdc->long_name : cdc->name,
+					                             cdc->name);
+				}
+			}
+			if (obsffmpeg::ipc::frame_tap::is_supported()) {
+				auto p = obs_properties_add_text(grp, ST_FFMPEG_FRAMETAP, TRANSLATE(ST_FFMPEG_FRAMETAP),
+				                                 OBS_TEXT_DEFAULT);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_FRAMETAP)));
+
+				p = obs_properties_add_int(grp, ST_FFMPEG_FRAMETAP_INTERVAL,
+				                           TRANSLATE(ST_FFMPEG_FRAMETAP_INTERVAL), 0, 3600, 1);
+				obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_FRAMETAP_INTERVAL)));
+				obs_property_int_set_suffix(p, " frames");
+			}
 		}
 		{
 			auto p = obs_properties_add_list(grp, ST_FFMPEG_STANDARDCOMPLIANCE,
@@ -598,6 +802,36 @@ void obsffmpeg::encoder_factory::get_properties(obs_properties_t* props, bool hw
 			obs_property_list_add_int(p, TRANSLATE(ST_FFMPEG_STANDARDCOMPLIANCE ".Experimental"),
 			                          FF_COMPLIANCE_EXPERIMENTAL);
 		}
+		{
+			auto p = obs_properties_add_list(grp, ST_FFMPEG_PRIORITY, TRANSLATE(ST_FFMPEG_PRIORITY),
+			                                 OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+			obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_PRIORITY)));
+			obs_property_list_add_int(p, TRANSLATE(ST_FFMPEG_PRIORITY_(Live)),
+			                          static_cast<int64_t>(obsffmpeg::thread_priority::LIVE));
+			obs_property_list_add_int(p, TRANSLATE(ST_FFMPEG_PRIORITY_(Recording)),
+			                          static_cast<int64_t>(obsffmpeg::thread_priority::RECORDING));
+			obs_property_list_add_int(p, TRANSLATE(ST_FFMPEG_PRIORITY_(Background)),
+			                          static_cast<int64_t>(obsffmpeg::thread_priority::BACKGROUND));
+		}
+		{
+			auto p = obs_properties_add_int_slider(grp, ST_FFMPEG_DECIMATION,
+			                                       TRANSLATE(ST_FFMPEG_DECIMATION), 1, 10, 1);
+			obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_DECIMATION)));
+		}
+		{
+			auto p = obs_properties_add_bool(grp, ST_FFMPEG_FASTSTART, TRANSLATE(ST_FFMPEG_FASTSTART));
+			obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_FASTSTART)));
+		}
+		{
+			auto p =
+			    obs_properties_add_bool(grp, ST_FFMPEG_LOADSHEDDING, TRANSLATE(ST_FFMPEG_LOADSHEDDING));
+			obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_LOADSHEDDING)));
+		}
+		if (obsffmpeg::ipc::packet_bus::is_supported()) {
+			auto p = obs_properties_add_text(grp, ST_FFMPEG_PACKETBUS, TRANSLATE(ST_FFMPEG_PACKETBUS),
+			                                 OBS_TEXT_DEFAULT);
+			obs_property_set_long_description(p, TRANSLATE(DESC(ST_FFMPEG_PACKETBUS)));
+		}
 	};
 }
 
@@ -627,8 +861,15 @@ void obsffmpeg::encoder::initialize_sw(obs_data_t* settings)
 		AVPixelFormat _pixfmt_target =
 		    static_cast<AVPixelFormat>(obs_data_get_int(settings, ST_FFMPEG_COLORFORMAT));
 		if (_pixfmt_target == AV_PIX_FMT_NONE) {
-			// Find the best conversion format.
-			_pixfmt_target = ffmpeg::tools::get_least_lossy_format(_codec->pix_fmts, _pixfmt_source);
+			// Find the cheapest conversion format that is as good as the least lossy one. Alpha is never
+			// encoded from OBS output, so losing it does not count.
+			auto choice = ffmpeg::tools::get_best_format(_codec->pix_fmts, _pixfmt_source, FF_LOSS_ALPHA);
+			_pixfmt_target = choice.format;
+			PLOG_INFO("[%s] Selected color format '%s' for '%s' (loss: %s, cost: %.2f): %s.", _codec->name,
+			          ffmpeg::tools::get_pixel_format_name(choice.format),
+			          ffmpeg::tools::get_pixel_format_name(_pixfmt_source),
+			          ffmpeg::tools::get_loss_description(choice.loss).c_str(), choice.cost,
+			          choice.reason.c_str());
 
 			if (_handler) // Allow Handler to override the automatic color format for sanity reasons.
 				_handler->override_colorformat(_pixfmt_target, settings, _codec, _context);
@@ -653,6 +894,16 @@ void obsffmpeg::encoder::initialize_sw(obs_data_t* settings)
 		_context->height = static_cast<int>(obs_encoder_get_height(_self));
 		ffmpeg::tools::setup_obs_color(voi->colorspace, voi->range, _context);
 
+		// PQ and HLG need at least 10 bits, or gradients turn into visible bands.
+		_hdr = ffmpeg::tools::get_obs_hdr_metadata(voi->colorspace, _hdr_metadata);
+		if (_hdr) {
+			ffmpeg::tools::setup_hdr_metadata(_context, _hdr_metadata);
+			const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(_pixfmt_target);
+			if (desc && (desc->comp[0].depth < 10))
+				PLOG_WARNING("[%s] Color format '%s' has less than 10 bits, too few for HDR.",
+				             _codec->name, ffmpeg::tools::get_pixel_format_name(_pixfmt_target));
+		}
+
 		_context->pix_fmt                 = _pixfmt_target;
 		_context->field_order             = AV_FIELD_PROGRESSIVE;
 		_context->ticks_per_frame         = 1;
@@ -668,8 +919,19 @@ void obsffmpeg::encoder::initialize_sw(obs_data_t* settings)
 		_swscale.set_target_color(_context->color_range == AVCOL_RANGE_JPEG, _context->colorspace);
 		_swscale.set_target_format(_pixfmt_target);
 
-		// Create Scaler
-		if (!_swscale.initialize(SWS_POINT)) {
+		// Create Converter, using the backend the user asked for or the fastest one for this conversion.
+		std::string backend = obs_data_get_string(settings, ST_FFMPEG_CONVERTER);
+		if (!backend.empty()) {
+			_converter = ffmpeg::converter::create(backend, _swscale);
+			if (!_converter)
+				PLOG_WARNING("[%s] Converter '%s' is not usable here, selecting one automatically.",
+				             _codec->name, backend.c_str());
+		}
+		if (!_converter) {
+			backend    = ffmpeg::converter::select(_swscale);
+			_converter = ffmpeg::converter::create(backend, _swscale);
+		}
+		if (!_converter) {
 			std::stringstream sstr;
 			sstr << "Initializing scaler failed for conversion from '"
 			     << ffmpeg::tools::get_pixel_format_name(_swscale.get_source_format()) << "' to '"
@@ -679,6 +941,20 @@ void obsffmpeg::encoder::initialize_sw(obs_data_t* settings)
 			     << (_swscale.is_source_full_range() ? "full" : "partial") << " range.";
 			throw std::runtime_error(sstr.str());
 		}
+		PLOG_INFO("[%s] Converting frames with '%s'.", _codec->name, _converter->get_name());
+
+		// Mostly static content only needs the parts that changed converted again.
+		_strip_converter.reset();
+		if (obs_data_get_bool(settings, ST_FFMPEG_INCREMENTAL)) {
+			_strip_converter = std::make_shared<ffmpeg::strip_converter>(_swscale, backend);
+		}
+
+		// Scene detection is shared with every other encoder that receives the same frames.
+		_analysis.reset();
+		if (obs_data_get_bool(settings, ST_FFMPEG_SCENECUT)) {
+			_analysis = obsffmpeg::analysis::get(obs_encoder_video(_self), voi->format,
+			                                     _swscale.get_source_width(), _swscale.get_source_height());
+		}
 	}
 }
 
@@ -697,6 +973,10 @@ void obsffmpeg::encoder::initialize_hw(obs_data_t*)
 	ffmpeg::tools::setup_obs_color(voi->colorspace, voi->range, _context);
 	_context->sw_pix_fmt = ffmpeg::tools::obs_videoformat_to_avpixelformat(voi->format);
 
+	_hdr = ffmpeg::tools::get_obs_hdr_metadata(voi->colorspace, _hdr_metadata);
+	if (_hdr)
+		ffmpeg::tools::setup_hdr_metadata(_context, _hdr_metadata);
+
 #ifdef WIN32
 	_context->pix_fmt = AV_PIX_FMT_D3D11;
 #endif
@@ -733,11 +1013,16 @@ void obsffmpeg::encoder::push_free_frame(std::shared_ptr<AVFrame> frame)
 std::shared_ptr<AVFrame> obsffmpeg::encoder::pop_free_frame()
 {
 	std::shared_ptr<AVFrame> frame;
-	if (_free_frames.size() > 0) {
-		// Re-use existing frames first.
+	while (!frame && (_free_frames.size() > 0)) {
+		// Re-use existing frames first, unless someone else still holds a reference to their buffers.
 		frame = _free_frames.top();
 		_free_frames.pop();
-	} else {
+		if (!_hwinst && !av_frame_is_writable(frame.get()))
+			frame.reset();
+	}
+	if (!frame) {
+		_stats.allocations++;
+		TRACE_PROBE2(pool_miss, this, _stats.allocations);
 		if (_hwinst) {
 			frame = _hwinst->allocate_frame(_context->hw_frames_ctx);
 		} else {
@@ -772,25 +1057,115 @@ std::shared_ptr<AVFrame> obsffmpeg::encoder::pop_used_frame()
 	return frame;
 }
 
-obsffmpeg::encoder::encoder(obs_data_t* settings, obs_encoder_t* encoder, bool is_texture_encode)
-    : _self(encoder), _factory(reinterpret_cast<encoder_factory*>(obs_encoder_get_type_data(_self))),
-      _codec(_factory->get_avcodec()), _context(nullptr), _lag_in_frames(0), _count_send_frames(0),
-      _have_first_frame(false)
+bool obsffmpeg::encoder::skip_frame(int64_t pts)
 {
-	// Find a handler
-	_handler = obsffmpeg::find_codec_handler(_codec->name);
+	if (_decimation <= 1)
+		return false;
 
-	// Initialize GPU Stuff
-	if (is_texture_encode) {
-#ifdef WIN32
-		auto gctx = obsffmpeg::obs_graphics();
-		if (gs_get_device_type() == GS_DEVICE_DIRECT3D_11) {
-			_hwapi = std::make_shared<obsffmpeg::hwapi::d3d11>();
+	// Frames are picked by their timestamp rather than by counting, so that a frame OBS failed to deliver
+	// does not shift which frames are encoded, and key-frames stay on the same canvas frames.
+	if ((_decimation_last_pts != AV_NOPTS_VALUE) && ((pts / _decimation) <= (_decimation_last_pts / _decimation)))
+		return true;
+
+	_decimation_last_pts = pts;
+	return false;
+}
+
+void obsffmpeg::encoder::prepare_frame(AVFrame* frame, int64_t pts)
+{
+	frame->pts = pts / _decimation;
+	if (_hdr)
+		ffmpeg::tools::attach_hdr_metadata(frame, _hdr_metadata);
+
+	// Keep key-frames on the canvas frames an encoder without decimation would pick.
+	frame->pict_type = AV_PICTURE_TYPE_NONE;
+	if ((_decimation > 1) && (_context->gop_size > 0) && ((frame->pts % _context->gop_size) == 0))
+		frame->pict_type = AV_PICTURE_TYPE_I;
+
+	// Start a new GOP on scene changes, unless the last forced key-frame is less than a second ago. The
+	// change may have happened on a frame that decimation skipped.
+	if (_scene_change_pending) {
+		int64_t distance = (_scene_keyframe_pts != AV_NOPTS_VALUE) ? (frame->pts - _scene_keyframe_pts)
+		                                                           : std::numeric_limits<int64_t>::max();
+		if (distance >= (_context->time_base.den / std::max(_context->time_base.num, 1)))
+			frame->pict_type = AV_PICTURE_TYPE_I;
+		_scene_change_pending = false;
+	}
+	if (frame->pict_type == AV_PICTURE_TYPE_I)
+		_scene_keyframe_pts = frame->pts;
+}
+
+void obsffmpeg::encoder::rescale_packet(AVPacket* packet)
+{
+	// The shadow knows the frames it sampled by their timestamps in the codec.
+	if (_shadow)
+		_shadow->compare(packet);
+
+	// OBS expects timestamps in canvas frames.
+	if (packet->pts != AV_NOPTS_VALUE)
+		packet->pts *= _decimation;
+	if (packet->dts != AV_NOPTS_VALUE)
+		packet->dts *= _decimation;
+
+	// A rebuilt context starts its decode timestamps over, which puts them at or before the last packet of the
+	// previous context when it reorders more frames. Its first packet decides a single offset for the whole
+	// context, applied to both timestamps so that the order the codec chose stays valid.
+	if (_timestamp_offset_pending && (packet->dts != AV_NOPTS_VALUE)) {
+		if ((_last_dts != AV_NOPTS_VALUE) && (packet->dts + _timestamp_offset <= _last_dts)) {
+			int64_t offset = _last_dts + _decimation - packet->dts;
+
+			// Layers of frames already sent to this context were remembered with the previous offset.
+			std::map<int64_t, uint32_t> layers;
+			for (auto kv : _temporal_layers) {
+				if (kv.first >= packet->pts + _timestamp_offset) {
+					layers[kv.first - _timestamp_offset + offset] = kv.second;
+				} else {
+					layers[kv.first] = kv.second;
+				}
+			}
+			_temporal_layers.swap(layers);
+
+			PLOG_INFO("[%s] Delaying timestamps of rebuilt context by %lld frames.", _codec->name,
+			          static_cast<long long>(offset - _timestamp_offset));
+			_timestamp_offset = offset;
 		}
-#endif
-		_hwinst = _hwapi->create_from_obs();
+		_timestamp_offset_pending = false;
+	}
+
+	if (packet->pts != AV_NOPTS_VALUE)
+		packet->pts += _timestamp_offset;
+	if (packet->dts != AV_NOPTS_VALUE) {
+		packet->dts += _timestamp_offset;
+		if ((packet->pts != AV_NOPTS_VALUE) && (packet->dts > packet->pts))
+			PLOG_WARNING("[%s] Packet is decoded after it is shown (dts %lld, pts %lld).", _codec->name,
+			             static_cast<long long>(packet->dts), static_cast<long long>(packet->pts));
+		_last_dts = packet->dts;
 	}
+}
 
+uint32_t obsffmpeg::encoder::get_packet_priority(int64_t pts)
+{
+	auto found = _temporal_layers.find(pts);
+	if (found == _temporal_layers.end())
+		return OBS_NAL_PRIORITY_HIGH;
+
+	uint32_t layer = found->second;
+	_temporal_layers.erase(found);
+	if (_temporal_pattern.size() == 0)
+		return OBS_NAL_PRIORITY_HIGH;
+
+	// The top layer is never referenced, and anything in between only by layers above it.
+	uint32_t top = *std::max_element(_temporal_pattern.begin(), _temporal_pattern.end());
+	if (layer == 0) {
+		return OBS_NAL_PRIORITY_HIGH;
+	} else if (layer >= top) {
+		return OBS_NAL_PRIORITY_DISPOSABLE;
+	}
+	return OBS_NAL_PRIORITY_LOW;
+}
+
+void obsffmpeg::encoder::initialize_context(obs_data_t* settings)
+{
 	// Initialize context.
 	_context = avcodec_alloc_context3(_codec);
 	if (!_context) {
@@ -798,51 +1173,618 @@ obsffmpeg::encoder::encoder(obs_data_t* settings, obs_encoder_t* encoder, bool i
 		throw std::runtime_error("failed to create context");
 	}
 
-	// Create 8MB of precached Packet data for use later on.
-	av_init_packet(&_current_packet);
-	av_new_packet(&_current_packet, 8 * 1024 * 1024); // 8 MB precached Packet size.
-
-	if (is_texture_encode) {
+	if (_hwinst) {
 		initialize_hw(settings);
 	} else {
 		initialize_sw(settings);
 	}
 
 	// Update settings
+	_temporal_pattern.clear();
+	_temporal_index = 0;
 	update(settings);
 
+	// The settings were made for the codec that failed, so the fallback continues with the rate control
+	// and key-frame interval that codec used instead.
+	// Outputs only ask for extra data when they start, so running ones keep the headers of the failed codec
+	// and the fallback has to repeat its own with every key-frame.
+	if (_failover_active) {
+		_context->bit_rate       = _failover_bit_rate;
+		_context->rc_max_rate    = _failover_max_rate;
+		_context->rc_buffer_size = _failover_buffer_size;
+		_context->gop_size       = _failover_gop_size;
+		_context->keyint_min     = _failover_gop_size;
+		_context->flags &= ~AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+
+	// Fast start trades efficiency for latency until the first GOP boundary, where the context is rebuilt
+	// with the full configuration.
+	if (_fast_start) {
+		if (!_hwinst && (_context->thread_type & FF_THREAD_FRAME)) {
+			// Frame threading delays the first packet by one frame per thread.
+			_context->thread_type &= ~FF_THREAD_FRAME;
+			if (_context->thread_type == 0)
+				_context->thread_count = 1;
+			_context->delay = 0;
+		}
+		for (auto option : {"rc-lookahead", "lag-in-frames", "look_ahead_depth"}) {
+			av_opt_set_int(_context, option, 0, AV_OPT_SEARCH_CHILDREN);
+		}
+	}
+
+	// Load shedding asked for a faster preset, on top of whatever the settings chose. Whether there is one is
+	// decided before, so the level stays available while it is applied.
+	bool faster_preset = !_hwinst && ffmpeg::tools::has_faster_preset(_context);
+	if ((_shed >= obsffmpeg::shed_level::PRESET) && faster_preset) {
+		if (!ffmpeg::tools::set_faster_preset(_context))
+			PLOG_WARNING("[%s] Unable to shed load with a faster preset.", _codec->name);
+	}
+
 	// Initialize Encoder
 	auto gctx = obsffmpeg::obs_graphics();
-	int  res  = avcodec_open2(_context, _codec, NULL);
-	if (res < 0) {
-		std::stringstream sstr;
-		sstr << "Initializing encoder '" << _codec->name
-		     << "' failed with error: " << ffmpeg::tools::get_error_description(res) << " (code " << res << ")";
-		throw std::runtime_error(sstr.str());
+	{
+		obsffmpeg::threading::thread_capture capture;
+		int                                  res = avcodec_open2(_context, _codec, NULL);
+		if (res < 0) {
+			std::stringstream sstr;
+			sstr << "Initializing encoder '" << _codec->name << "' failed with error: "
+			     << ffmpeg::tools::get_error_description(res) << " (code " << res << ")";
+			throw std::runtime_error(sstr.str());
+		}
+
+		// Threads this thread started while opening belong to the codec.
+		for (auto tid : capture.get_threads()) {
+			_codec_threads[tid] = 0;
+		}
+	}
+	for (auto kv : _codec_threads) {
+		obsffmpeg::threading::set_priority(kv.first, _priority);
+	}
+
+	// Slice jobs are run on the shared pool for this priority instead of the codec's own workers.
+	if (_context->active_thread_type == FF_THREAD_SLICE) {
+		_context->opaque   = this;
+		_context->execute  = _execute;
+		_context->execute2 = _execute2;
+	}
+
+	// Intra-only codecs can encode several frames at once on copies of the context, which are run on the
+	// shared pool. The context itself stays open for headers and handlers.
+	_parallel.reset();
+	int64_t parallel = obs_data_get_int(settings, ST_FFMPEG_FRAMEPARALLEL);
+	if (!_hwinst && (parallel > 1) && ffmpeg::frame_parallel::is_supported(_codec)) {
+		try {
+			_parallel = std::make_shared<ffmpeg::frame_parallel>(
+			    _codec, _context, static_cast<size_t>(parallel), [this](std::function<void()> task) {
+				    _threadpool->push([this, task]() {
+					    obsffmpeg::threading::cpu_time_scope cpu_time(_cpu_time_pool);
+					    task();
+				    });
+			    });
+			PLOG_INFO("[%s] Encoding %llu frames in parallel.", _codec->name,
+			          static_cast<unsigned long long>(_parallel->get_count()));
+		} catch (const std::exception& ex) {
+			PLOG_WARNING("[%s] Unable to encode frames in parallel: %s", _codec->name, ex.what());
+		}
+	}
+
+	// Shadow encoding, kept across updates and rebuilds as long as the candidate and the frames stay the same.
+	if (!_hwinst) {
+		const char* options = obs_data_get_string(settings, ST_FFMPEG_SHADOW);
+		if (!options || (options[0] == '\0')) {
+			_shadow.reset();
+			_shadow_options.clear();
+		} else if (!_shadow || (_shadow_options != options) || !_shadow->matches(_codec, _context)) {
+			_shadow.reset();
+			_shadow_options = options;
+			try {
+				_shadow = std::make_shared<obsffmpeg::shadow_encoder>(
+				    _codec, _context,
+				    [this](AVCodecContext* context) {
+					    parse_ffmpeg_commandline(_shadow_options, context);
+				    },
+				    [this]() {
+					    encoder_stats stats = get_stats();
+					    return stats.cpu_time_self + stats.cpu_time_pool + stats.cpu_time_codec;
+				    });
+				PLOG_INFO("[%s] Shadow encoding sampled frames with '%s'.", _codec->name, options);
+			} catch (const std::exception& ex) {
+				PLOG_WARNING("[%s] Unable to create shadow encoder: %s", _codec->name, ex.what());
+			}
+		}
+	}
+
+	// Load shedding, kept across rebuilds as the level it applies outlives them. Encoders that may not shed
+	// anything still report their load, so that others make room for them.
+	{
+		std::vector<obsffmpeg::shed_level> levels;
+		if (obs_data_get_bool(settings, ST_FFMPEG_LOADSHEDDING) && (_deterministic_threads == 0)) {
+			if (!_hwinst)
+				levels.push_back(obsffmpeg::shed_level::AUXILIARY);
+			// Live encoders only give up work that does not change their output.
+			if (_priority != obsffmpeg::thread_priority::LIVE) {
+				if (faster_preset)
+					levels.push_back(obsffmpeg::shed_level::PRESET);
+				levels.push_back(obsffmpeg::shed_level::DECIMATE);
+			}
+		}
+		if (!_shedder || (_shedder->get_priority() != _priority) || !_shedder->has_levels(levels))
+			_shedder =
+			    std::make_shared<obsffmpeg::load_shedder>(obs_encoder_get_name(_self), _priority, levels);
+		_shedder->set_applied(_shed);
+	}
+
+	_have_first_frame = false;
+
+	if (_fast_start) {
+		if (_context->gop_size > 0) {
+			_reconfigure_pending = true;
+		} else {
+			_fast_start = false;
+		}
 	}
 }
 
-obsffmpeg::encoder::~encoder()
+void obsffmpeg::encoder::finalize_context(bool keep_packets)
 {
+	if (!_context)
+		return;
+
+	// Frames still encoding in parallel come before anything else.
+	if (_parallel) {
+		_parallel->wait();
+		while (true) {
+			std::shared_ptr<AVPacket> pkt =
+			    std::shared_ptr<AVPacket>(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+			if (_parallel->receive_packet(pkt.get(), false) < 0)
+				break;
+
+			if (keep_packets) {
+				if (_handler)
+					_handler->process_avpacket(*pkt, _codec, _context);
+				rescale_packet(pkt.get());
+				_pending_packets.push(pkt);
+			}
+		}
+		_parallel.reset();
+	}
+
 	auto gctx = obsffmpeg::obs_graphics();
-	if (_context) {
-		// Flush encoders that require it.
-		if ((_codec->capabilities & AV_CODEC_CAP_DELAY) != 0) {
-			avcodec_send_frame(_context, nullptr);
-			while (avcodec_receive_packet(_context, &_current_packet) >= 0) {
-				avcodec_send_frame(_context, nullptr);
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// Flush encoders that require it.
+	if ((_codec->capabilities & AV_CODEC_CAP_DELAY) != 0) {
+		avcodec_send_frame(_context, nullptr);
+		while (true) {
+			std::shared_ptr<AVPacket> pkt =
+			    std::shared_ptr<AVPacket>(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+			if (avcodec_receive_packet(_context, pkt.get()) < 0)
+				break;
+
+			if (keep_packets) {
+				// Handler Post-Processing must happen with the context that created the packet.
+				if (_handler)
+					_handler->process_avpacket(*pkt, _codec, _context);
+				rescale_packet(pkt.get());
+				_pending_packets.push(pkt);
 			}
 		}
+	}
+
+	// Codec threads are about to exit, so remember what they used.
+	uint64_t cpu_time_codec = get_codec_cpu_time();
+	_cpu_time_codec_closed += cpu_time_codec;
+	_codec_threads.clear();
+
+	// Close and free context.
+	avcodec_close(_context);
+	avcodec_free_context(&_context);
 
-		// Close and free context.
+	// Frames in flight belonged to the old context and will never produce a packet again.
+	while (_used_frames.size() > 0) {
+		_used_frames.pop();
+	}
+	while (_free_frames.size() > 0) {
+		_free_frames.pop();
+	}
+
+	// The next context decides its own timestamp offset from its first packet.
+	_timestamp_offset_pending = true;
+}
+
+void obsffmpeg::encoder::abandon_context()
+{
+	// A context that failed to rebuild is in no state to encode, so it is freed and every later call fails
+	// instead of using it.
+	_parallel.reset();
+	if (_context) {
+		uint64_t cpu_time_codec = get_codec_cpu_time();
+		_cpu_time_codec_closed += cpu_time_codec;
+		_codec_threads.clear();
 		avcodec_close(_context);
 		avcodec_free_context(&_context);
 	}
+	_failed              = true;
+	_reconfigure_pending = false;
+}
+
+bool obsffmpeg::encoder::needs_reconfigure()
+{
+	// Input changes can't wait, as the old scaler and frames no longer match what OBS gives us.
+	auto voi = video_output_get_info(obs_encoder_video(_self));
+	if (_hwinst) {
+		if ((static_cast<int>(voi->width) != _context->width)
+		    || (static_cast<int>(voi->height) != _context->height)
+		    || (ffmpeg::tools::obs_videoformat_to_avpixelformat(voi->format) != _context->sw_pix_fmt)) {
+			return true;
+		}
+	} else {
+		if ((obs_encoder_get_width(_self) != _swscale.get_source_width())
+		    || (obs_encoder_get_height(_self) != _swscale.get_source_height())
+		    || (ffmpeg::tools::obs_videoformat_to_avpixelformat(voi->format) != _swscale.get_source_format())) {
+			return true;
+		}
+	}
+
+	// Settings changes are applied at the next GOP boundary, and fast start lasts for at least one GOP.
+	if (_reconfigure_pending) {
+		if (_fast_start && (_count_send_frames == 0))
+			return false;
+		return (_context->gop_size <= 0)
+		       || ((_count_send_frames % static_cast<size_t>(_context->gop_size)) == 0);
+	}
+
+	return false;
+}
+
+void obsffmpeg::encoder::reconfigure()
+{
+#ifdef _DEBUG
+	ScopeProfiler profile("reconfigure");
+#endif
+
+	auto begin = std::chrono::high_resolution_clock::now();
+
+	bool fast_start = _fast_start;
+	_fast_start     = false;
+
+	obs_data_t* settings = obs_encoder_get_settings(_self);
+	try {
+		// Only the scaler, frame pools and codec context are rebuilt. Packets still held by the
+		// old context are kept and returned before any packet from the new one.
+		finalize_context(true);
+		_converter.reset();
+		initialize_context(settings);
+	} catch (...) {
+		obs_data_release(settings);
+		abandon_context();
+		throw;
+	}
+	obs_data_release(settings);
+
+	_reconfigure_pending = false;
+	_count_send_frames   = 0;
+	_stats.reconfigures++;
+
+	PLOG_INFO("[%s] Reconfigured encoder%s in %.3f ms, %llu packets carried over.", _codec->name,
+	          fast_start ? " after fast start" : "",
+	          std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count(),
+	          static_cast<unsigned long long>(_pending_packets.size()));
+}
+
+bool obsffmpeg::encoder::handle_encode_error()
+{
+	// Without a fallback any error ends the stream, as the codec state is unknown.
+	if (!_failover_codec)
+		return false;
+
+	// Single errors only cost the current frame, repeated ones replace the codec.
+	if (++_failover_errors < 3)
+		return true;
+
+	try {
+		failover();
+	} catch (const std::exception& ex) {
+		PLOG_ERROR("[%s] Failover failed: %s", _codec->name, ex.what());
+		return false;
+	}
+	return true;
+}
+
+void obsffmpeg::encoder::failover()
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+
+	const AVCodec* failed = _codec;
+	_failover_bit_rate    = _context->bit_rate;
+	_failover_max_rate    = _context->rc_max_rate;
+	_failover_buffer_size = _context->rc_buffer_size;
+	_failover_gop_size    = _context->gop_size;
+
+	// This works like a reconfiguration with a different codec, so the first packet of the fallback is a
+	// key-frame with its headers in-band, and timestamps continue where the failed codec stopped.
+	obs_data_t* settings = obs_encoder_get_settings(_self);
+	try {
+		finalize_context(true);
+		_converter.reset();
+
+		_codec           = _failover_codec;
+		_handler         = obsffmpeg::find_codec_handler(_codec->name);
+		_failover_codec  = nullptr;
+		_failover_active = true;
+		_fast_start      = false;
+		initialize_context(settings);
+	} catch (...) {
+		obs_data_release(settings);
+		abandon_context();
+		throw;
+	}
+	obs_data_release(settings);
+
+	_reconfigure_pending = false;
+	_count_send_frames   = 0;
+	_failover_errors     = 0;
+	_stats.failovers++;
+
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin);
+	PLOG_WARNING("[%s] Replaced failing encoder '%s' in %.3f ms, %llu packets carried over.", _codec->name,
+	             failed->name, elapsed.count(), static_cast<unsigned long long>(_pending_packets.size()));
+}
+
+uint64_t obsffmpeg::encoder::get_codec_cpu_time()
+{
+	// Threads report nothing once they exited, so each one only ever counts the highest time seen, and the
+	// ones that are gone are moved to the total of closed threads.
+	uint64_t time = 0;
+	for (auto kv = _codec_threads.begin(); kv != _codec_threads.end();) {
+		uint64_t now = obsffmpeg::threading::get_cpu_time(kv->first);
+		if (now == 0) {
+			_cpu_time_codec_closed += kv->second;
+			kv = _codec_threads.erase(kv);
+			continue;
+		}
+		kv->second = std::max(kv->second, now);
+		time += kv->second;
+		++kv;
+	}
+	return time;
+}
+
+void obsffmpeg::encoder::log_stats()
+{
+	encoder_stats stats  = get_stats();
+	uint64_t      frames = stats.frames - _stats_logged.frames;
+	if (frames == 0)
+		return;
+
+	double_t self  = static_cast<double_t>(stats.cpu_time_self - _stats_logged.cpu_time_self) / 1000000.0;
+	double_t pool  = static_cast<double_t>(stats.cpu_time_pool - _stats_logged.cpu_time_pool) / 1000000.0;
+	double_t codec = static_cast<double_t>(stats.cpu_time_codec - _stats_logged.cpu_time_codec) / 1000000.0;
+	PLOG_INFO("[%s] CPU time: %.3f ms/frame (Encode: %.3f ms, Pool: %.3f ms, Codec: %.3f ms) over %llu frames.",
+	          _codec->name, (self + pool + codec) / frames, self / frames, pool / frames, codec / frames,
+	          static_cast<unsigned long long>(frames));
+
+	if (_shadow) {
+		// Both sides are averaged over the frames of complete samples only.
+		shadow_stats shadow = _shadow->get_stats();
+		if (shadow.frames > 0) {
+			auto ratio = [](double_t v, uint64_t n) { return (n > 0) ? (v / n) : 0.0; };
+			PLOG_INFO("[%s] Shadow: CPU time %.3f ms/frame (%.3f ms), Latency %.3f ms (%.3f ms), "
+			          "Size %.1f kbit/frame (%.1f kbit), QP %.2f (%.2f), PSNR %.2f dB over %llu frames, "
+			          "%llu skipped.",
+			          _codec->name, ratio(shadow.cpu_time / 1000000.0, shadow.frames),
+			          ratio(shadow.primary_cpu_time / 1000000.0, shadow.frames),
+			          ratio(shadow.latency / 1000000.0, shadow.frames),
+			          ratio(shadow.primary_latency / 1000000.0, shadow.frames),
+			          ratio(shadow.bytes * 8.0 / 1000.0, shadow.frames),
+			          ratio(shadow.primary_bytes * 8.0 / 1000.0, shadow.frames),
+			          ratio(static_cast<double_t>(shadow.quality) / FF_QP2LAMBDA, shadow.quality_packets),
+			          ratio(static_cast<double_t>(shadow.primary_quality) / FF_QP2LAMBDA,
+			                shadow.primary_quality_packets),
+			          ratio(shadow.psnr, shadow.psnr_packets),
+			          static_cast<unsigned long long>(shadow.frames),
+			          static_cast<unsigned long long>(shadow.skipped));
+		}
+	}
+
+	_stats_logged      = stats;
+	_stats_logged_time = std::chrono::high_resolution_clock::now();
+}
+
+void obsffmpeg::encoder::write_stats()
+{
+	const char* path = getenv(ST_ENV_STATS);
+	if (!path || (path[0] == '\0'))
+		return;
+
+	encoder_stats stats = get_stats();
+	if (stats.frames == 0)
+		return;
+
+	auto per_frame = [&stats](uint64_t v) { return static_cast<double_t>(v) / 1000000.0 / stats.frames; };
+
+	std::ofstream file(path, std::ios::out | std::ios::app);
+	if (!file.is_open()) {
+		PLOG_WARNING("[%s] Unable to write statistics to '%s'.", _codec->name, path);
+		return;
+	}
+
+	file << std::fixed << std::setprecision(6);
+	file << "{\"codec\":\"" << _codec->name << "\"";
+	if (_converter) {
+		file << ",\"converter\":\"" << _converter->get_name() << "\"";
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(_swscale.get_target_format());
+		if (desc)
+			file << ",\"bits\":" << desc->comp[0].depth;
+	}
+	file << ",\"width\":" << obs_encoder_get_width(_self) << ",\"height\":" << obs_encoder_get_height(_self);
+	file << ",\"frames\":" << stats.frames << ",\"packets\":" << stats.packets;
+	file << ",\"bytes\":" << (static_cast<double_t>(stats.bytes) / stats.frames);
+	if (stats.quality_packets > 0)
+		file << ",\"qp\":" << (static_cast<double_t>(stats.quality) / FF_QP2LAMBDA / stats.quality_packets);
+	file << ",\"fps\":"
+	     << (stats.time_encode > 0 ? (stats.frames * 1000000000.0 / static_cast<double_t>(stats.time_encode))
+	                               : 0.0);
+	file << ",\"encode_ms\":" << per_frame(stats.time_encode);
+	file << ",\"convert_ms\":" << per_frame(stats.time_convert);
+	file << ",\"send_ms\":" << per_frame(stats.time_send);
+	file << ",\"receive_ms\":" << per_frame(stats.time_receive);
+	file << ",\"cpu_ms\":" << per_frame(stats.cpu_time_self + stats.cpu_time_pool + stats.cpu_time_codec);
+	file << ",\"allocations\":" << stats.allocations;
+	file << ",\"failovers\":" << stats.failovers;
+	file << ",\"first_packet_ms\":" << (static_cast<double_t>(stats.time_first_packet) / 1000000.0);
+	file << ",\"priority\":\"" << obsffmpeg::threading::get_priority_name(_priority) << "\"";
+	{
+		uint64_t total = 0;
+		for (auto count : _latency_histogram)
+			total += count;
+		auto percentile = [this, total](double_t share) {
+			uint64_t rank = static_cast<uint64_t>(std::ceil(share * total)), seen = 0;
+			for (size_t idx = 0; idx < _latency_histogram.size(); idx++) {
+				seen += _latency_histogram[idx];
+				if (seen >= rank)
+					return static_cast<double_t>((idx + 1) * ST_LATENCY_STEP) / 1000000.0;
+			}
+			return static_cast<double_t>(ST_LATENCY_STEPS * ST_LATENCY_STEP) / 1000000.0;
+		};
+		if (total > 0)
+			file << ",\"latency_p50_ms\":" << percentile(0.5) << ",\"latency_p99_ms\":" << percentile(0.99);
+	}
+	if (_deterministic_threads > 0) {
+		char checksum[9];
+		snprintf(checksum, sizeof(checksum), "%08" PRIx32, _packet_checksum);
+		file << ",\"threads\":" << _deterministic_threads << ",\"checksum\":\"" << checksum << "\"";
+	}
+	if (_shadow) {
+		shadow_stats shadow = _shadow->get_stats();
+		if (shadow.frames > 0) {
+			auto per_shadow = [&shadow](uint64_t v) {
+				return static_cast<double_t>(v) / 1000000.0 / shadow.frames;
+			};
+			file << ",\"shadow_options\":\"";
+			for (char c : _shadow_options) {
+				if ((c == '"') || (c == '\\'))
+					file << '\\';
+				file << c;
+			}
+			file << "\"";
+			file << ",\"shadow_frames\":" << shadow.frames << ",\"shadow_skipped\":" << shadow.skipped;
+			file << ",\"shadow_cpu_ms\":" << per_shadow(shadow.cpu_time);
+			file << ",\"shadow_latency_ms\":" << per_shadow(shadow.latency);
+			file << ",\"shadow_bytes\":" << (static_cast<double_t>(shadow.bytes) / shadow.frames);
+			if (shadow.quality_packets > 0)
+				file << ",\"shadow_qp\":"
+				     << (static_cast<double_t>(shadow.quality) / FF_QP2LAMBDA / shadow.quality_packets);
+
+			// The encoder itself on the frames the shadow encoded.
+			file << ",\"shadow_primary_cpu_ms\":" << per_shadow(shadow.primary_cpu_time);
+			file << ",\"shadow_primary_latency_ms\":" << per_shadow(shadow.primary_latency);
+			file << ",\"shadow_primary_bytes\":"
+			     << (static_cast<double_t>(shadow.primary_bytes) / shadow.frames);
+			if (shadow.primary_quality_packets > 0)
+				file << ",\"shadow_primary_qp\":"
+				     << (static_cast<double_t>(shadow.primary_quality) / FF_QP2LAMBDA
+				         / shadow.primary_quality_packets);
+			if (shadow.psnr_packets > 0)
+				file << ",\"shadow_psnr\":" << (shadow.psnr / shadow.psnr_packets);
+		}
+	}
+	file << "}" << std::endl;
+}
+
+obsffmpeg::encoder::encoder(obs_data_t* settings, obs_encoder_t* encoder, bool is_texture_encode)
+    : _self(encoder), _factory(reinterpret_cast<encoder_factory*>(obs_encoder_get_type_data(_self))),
+      _codec(_factory->get_avcodec()), _context(nullptr), _priority(obsffmpeg::thread_priority::LIVE),
+      _lag_in_frames(0), _count_send_frames(0), _have_first_frame(false), _hdr(false), _cpu_time_self(0),
+      _cpu_time_pool(0), _cpu_time_codec_closed(0), _latency_histogram(ST_LATENCY_STEPS, 0),
+      _latency_last(0), _soak_churn(0), _deterministic_threads(0),
+      _packet_checksum(0), _decimation(1), _decimation_last_pts(AV_NOPTS_VALUE),
+      _temporal_index(0), _scene_change_pending(false), _scene_keyframe_pts(AV_NOPTS_VALUE),
+      _reconfigure_pending(false), _last_dts(AV_NOPTS_VALUE), _timestamp_offset(0),
+      _timestamp_offset_pending(false), _failed(false), _failover_codec(nullptr), _failover_errors(0),
+      _failover_active(false), _failover_bit_rate(0), _failover_max_rate(0), _failover_buffer_size(0),
+      _failover_gop_size(0), _fast_start(false), _created(std::chrono::high_resolution_clock::now()),
+      _shed(obsffmpeg::shed_level::NONE)
+{
+	// Find a handler
+	_handler = obsffmpeg::find_codec_handler(_codec->name);
+
+	// Initialize GPU Stuff
+	if (is_texture_encode) {
+#ifdef WIN32
+		auto gctx = obsffmpeg::obs_graphics();
+		if (gs_get_device_type() == GS_DEVICE_DIRECT3D_11) {
+			_hwapi = std::make_shared<obsffmpeg::hwapi::d3d11>();
+		}
+#endif
+		_hwinst = _hwapi->create_from_obs();
+	}
+
+	_stats_logged_time = std::chrono::high_resolution_clock::now();
+
+	// Packet trace, one file per encoder instance.
+	const char* trace = getenv(ST_ENV_TRACE);
+	if (trace && (trace[0] != '\0')) {
+		std::stringstream sstr;
+		sstr << trace << "-" << obs_encoder_get_name(_self) << "-" << reinterpret_cast<uintptr_t>(this)
+		     << ".jsonl";
+		_packet_trace.open(sstr.str(), std::ios::out | std::ios::trunc);
+		_packet_trace_start = std::chrono::high_resolution_clock::now();
+		if (!_packet_trace.is_open())
+			PLOG_WARNING("[%s] Unable to write packet trace to '%s'.", _codec->name, sstr.str().c_str());
+	}
+
+	// Soak samples, one line per encoder every few seconds.
+	const char* soak = getenv(ST_ENV_SOAK);
+	if (soak && (soak[0] != '\0')) {
+		std::stringstream sstr;
+		sstr << obs_encoder_get_name(_self) << "-" << reinterpret_cast<uintptr_t>(this);
+		_soak = std::make_shared<soak_monitor>(soak, sstr.str(), std::chrono::seconds(10));
+
+		const char* churn = getenv(ST_ENV_SOAK_CHURN);
+		if (churn)
+			_soak_churn = strtoull(churn, nullptr, 10);
+	}
+
+	// Deterministic mode, where output only depends on input and settings, never on timing.
+	const char* deterministic = getenv(ST_ENV_DETERMINISTIC);
+	if (deterministic && (deterministic[0] != '\0')) {
+		_deterministic_threads = std::max<size_t>(strtoull(deterministic, nullptr, 10), 1);
+		PLOG_INFO("[%s] Deterministic mode with %llu codec threads.", _codec->name,
+		          static_cast<unsigned long long>(_deterministic_threads));
+	}
+
+	// Packet bus for local readers, which outlives any reconfiguration. Packets carry canvas timestamps.
+	const char* bus = obs_data_get_string(settings, ST_FFMPEG_PACKETBUS);
+	if (bus && (bus[0] != '\0') && obsffmpeg::ipc::packet_bus::is_supported()) {
+		try {
+			auto voi    = video_output_get_info(obs_encoder_video(_self));
+			_packet_bus = std::make_shared<obsffmpeg::ipc::packet_bus>(bus, _codec->name, voi->fps_den,
+			                                                           voi->fps_num);
+			PLOG_INFO("[%s] Publishing packets to bus '%s', announced in '%s'.", _codec->name, bus,
+			          _packet_bus->get_announce_path().c_str());
+		} catch (const std::exception& ex) {
+			PLOG_WARNING("[%s] Unable to create packet bus '%s': %s", _codec->name, bus, ex.what());
+		}
+	}
+
+	_fast_start = obs_data_get_bool(settings, ST_FFMPEG_FASTSTART);
+
+	// Create 8MB of precached Packet data for use later on.
+	av_init_packet(&_current_packet);
+	av_new_packet(&_current_packet, 8 * 1024 * 1024); // 8 MB precached Packet size.
+
+	initialize_context(settings);
+}
+
+obsffmpeg::encoder::~encoder()
+{
+	finalize_context(false);
+	log_stats();
+	write_stats();
 
 	av_packet_unref(&_current_packet);
 
-	_swscale.finalize();
+	_converter.reset();
 }
 
 void obsffmpeg::encoder::get_properties(obs_properties_t* props, bool hw_encode)
@@ -857,12 +1799,52 @@ void obsffmpeg::encoder::get_properties(obs_properties_t* props, bool hw_encode)
 
 	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_COLORFORMAT), false);
 	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_THREADS), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_FRAMEPARALLEL), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_SHADOW), false);
 	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_STANDARDCOMPLIANCE), false);
 	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_GPU), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_PRIORITY), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_DECIMATION), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_FASTSTART), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_LOADSHEDDING), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_CONVERTER), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_INCREMENTAL), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_SCENECUT), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_THUMBNAIL), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_THUMBNAIL_INTERVAL), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_THUMBNAIL_WIDTH), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_FRAMETAP), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_FRAMETAP_INTERVAL), false);
+	obs_property_set_enabled(obs_properties_get(props, ST_FFMPEG_PACKETBUS), false);
 }
 
 bool obsffmpeg::encoder::update(obs_data_t* settings)
 {
+	if (_failed)
+		return false;
+
+	if (avcodec_is_open(_context)) {
+		// Changing settings on an open context is not supported by most encoders, so instead the
+		// context is rebuilt at the next GOP boundary.
+		_reconfigure_pending = true;
+		return true;
+	}
+
+	// Priority
+	_priority   = static_cast<obsffmpeg::thread_priority>(obs_data_get_int(settings, ST_FFMPEG_PRIORITY));
+	_threadpool = obsffmpeg::threadpool::get(_priority);
+
+	// Decimation
+	_decimation = std::max<int64_t>(obs_data_get_int(settings, ST_FFMPEG_DECIMATION), 1);
+	_shed       = _shedder ? _shedder->get_level() : obsffmpeg::shed_level::NONE;
+	if (_shed >= obsffmpeg::shed_level::DECIMATE)
+		_decimation *= 2;
+	{
+		auto voi                = video_output_get_info(obs_encoder_video(_self));
+		_context->framerate.num = _context->time_base.den = static_cast<int>(voi->fps_num);
+		_context->framerate.den = _context->time_base.num = static_cast<int>(voi->fps_den * _decimation);
+	}
+
 	// FFmpeg Options
 	_context->debug                 = 0;
 	_context->strict_std_compliance = static_cast<int>(obs_data_get_int(settings, ST_FFMPEG_STANDARDCOMPLIANCE));
@@ -886,12 +1868,64 @@ bool obsffmpeg::encoder::update(obs_data_t* settings)
 		} else {
 			_context->thread_count = 1;
 		}
+		// The number of threads changes how some codecs split up work, and with it their output.
+		if ((_deterministic_threads > 0) && (_context->thread_type != 0))
+			_context->thread_count = static_cast<int>(_deterministic_threads);
 		// Frame Delay (Lag In Frames)
 		_context->delay = _context->thread_count;
 	} else {
 		_context->delay = 0;
 	}
 
+	// Thumbnails
+	_thumbnailer.reset();
+	if (!_hwinst) {
+		const char* path = obs_data_get_string(settings, ST_FFMPEG_THUMBNAIL);
+		if (path && (path[0] != '\0')) {
+			_thumbnailer = std::make_shared<obsffmpeg::thumbnailer>(
+			    path, static_cast<uint32_t>(obs_data_get_int(settings, ST_FFMPEG_THUMBNAIL_WIDTH)),
+			    obs_data_get_double(settings, ST_FFMPEG_THUMBNAIL_INTERVAL));
+		}
+	}
+
+	// Frame Tap, kept across updates as long as readers would not notice a difference.
+	if (!_hwinst && obsffmpeg::ipc::frame_tap::is_supported()) {
+		const char* name = obs_data_get_string(settings, ST_FFMPEG_FRAMETAP);
+		if (!name || (name[0] == '\0')) {
+			_frame_tap.reset();
+		} else if (!_frame_tap
+		           || !_frame_tap->matches(name, _context->pix_fmt, _context->width, _context->height)) {
+			_frame_tap.reset();
+			try {
+				_frame_tap = std::make_shared<obsffmpeg::ipc::frame_tap>(
+				    name, _context->pix_fmt, _context->width, _context->height);
+				PLOG_INFO("[%s] Publishing frames to tap '%s', announced in '%s'.", _codec->name, name,
+				          _frame_tap->get_announce_path().c_str());
+			} catch (const std::exception& ex) {
+				PLOG_WARNING("[%s] Unable to create frame tap '%s': %s", _codec->name, name, ex.what());
+			}
+		}
+		if (_frame_tap)
+			_frame_tap->set_interval(
+			    static_cast<uint32_t>(obs_data_get_int(settings, ST_FFMPEG_FRAMETAP_INTERVAL)));
+	}
+
+	// Failover, which needs frames in system memory.
+	if (!_failover_active) {
+		_failover_codec  = nullptr;
+		const char* name = obs_data_get_string(settings, ST_FFMPEG_FAILOVER);
+		if (_hwinst && name && (name[0] != '\0')) {
+			PLOG_WARNING("[%s] Ignoring failover encoder '%s', as frames are encoded from textures.",
+			             _codec->name, name);
+		} else if (name && (name[0] != '\0')) {
+			_failover_codec = avcodec_find_encoder_by_name(name);
+			if (!_failover_codec || (_failover_codec->id != _codec->id) || (_failover_codec == _codec)) {
+				PLOG_WARNING("[%s] Ignoring unsuitable failover encoder '%s'.", _codec->name, name);
+				_failover_codec = nullptr;
+			}
+		}
+	}
+
 	// Apply GPU Selection
 	if (!_hwinst && ffmpeg::tools::can_hardware_encode(_codec)) {
 		av_opt_set_int(_context, "gpu", (int)obs_data_get_int(settings, ST_FFMPEG_GPU), AV_OPT_SEARCH_CHILDREN);
@@ -915,6 +1949,14 @@ bool obsffmpeg::encoder::update(obs_data_t* settings)
 		} else {
 			_context->gop_size = static_cast<int>(obs_data_get_int(settings, S_KEYFRAMES_INTERVAL_FRAMES));
 		}
+		// The interval is given in canvas frames.
+		if (_decimation > 1) {
+			if ((_context->gop_size % _decimation) != 0)
+				PLOG_WARNING("[%s] Key-frame interval of %i frames is not a multiple of the frame rate "
+				             "divisor %lli, key-frames will not align with other encoders.",
+				             _codec->name, _context->gop_size, _decimation);
+			_context->gop_size = std::max(static_cast<int>(_context->gop_size / _decimation), 1);
+		}
 		_context->keyint_min = _context->gop_size;
 	}
 
@@ -943,6 +1985,7 @@ bool obsffmpeg::encoder::update(obs_data_t* settings)
 		          ffmpeg::tools::get_std_compliance_name(_context->strict_std_compliance));
 		PLOG_INFO("[%s]     Threading: %s (with %i threads)", _codec->name,
 		          ffmpeg::tools::get_thread_type_name(_context->thread_type), _context->thread_count);
+		PLOG_INFO("[%s]     Priority: %s", _codec->name, obsffmpeg::threading::get_priority_name(_priority));
 
 		PLOG_INFO("[%s]   Video:", _codec->name);
 		if (_hwinst) {
@@ -969,6 +2012,10 @@ bool obsffmpeg::encoder::update(obs_data_t* settings)
 		          _context->time_base.num,
 		          static_cast<double_t>(_context->time_base.den)
 		              / static_cast<double_t>(_context->time_base.num));
+		if (_decimation > 1)
+			PLOG_INFO("[%s]     Decimation: 1 of every %lli frames", _codec->name, _decimation);
+		if (_analysis)
+			PLOG_INFO("[%s]     Scene Detection: Shared", _codec->name);
 
 		PLOG_INFO("[%s]   Keyframes: ", _codec->name);
 		if (_context->keyint_min != _context->gop_size) {
@@ -1054,13 +2101,58 @@ static inline void copy_data(encoder_frame* frame, AVFrame* vframe)
 
 bool obsffmpeg::encoder::video_encode(encoder_frame* frame, encoder_packet* packet, bool* received_packet)
 {
-	std::shared_ptr<AVFrame> vframe = pop_free_frame(); // Retrieve an empty frame.
+	if (_failed)
+		return false;
+
+	obsffmpeg::threading::cpu_time_scope cpu_time(_cpu_time_self);
+	wall_time_scope                      wall_time(_stats.time_encode);
+	_stats.frames++;
+	TRACE_PROBE2(frame, this, frame->pts);
+
+	if (needs_reconfigure())
+		reconfigure();
+
+	if (_analysis) {
+		_analysis_current = _analysis->analyze(frame->data, frame->linesize);
+		if (_analysis_current && _analysis_current->scene_change)
+			_scene_change_pending = true;
+	}
+
+	if (skip_frame(frame->pts)) {
+		TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(trace_drop::DECIMATION));
+		*received_packet = false;
+		return true;
+	}
+
+	std::shared_ptr<AVFrame> vframe;
 
 	// Convert frame.
-	{
+	trace_time convert_time(TRACE_ENABLED(convert_end));
+	TRACE_PROBE2(convert_begin, this, frame->pts);
+	if (_strip_converter) {
 #ifdef _DEBUG
 		ScopeProfiler profile("convert");
 #endif
+		wall_time_scope wall_time(_stats.time_convert);
+
+		_strip_converter->convert(frame->data, reinterpret_cast<int*>(frame->linesize),
+		                          [this](size_t count, std::function<void(size_t, size_t)> job) {
+			                          execute(count, job);
+		                          });
+		vframe                  = _strip_converter->get_frame();
+		vframe->color_range     = _context->color_range;
+		vframe->colorspace      = _context->colorspace;
+		vframe->color_primaries = _context->color_primaries;
+		vframe->color_trc       = _context->color_trc;
+		prepare_frame(vframe.get(), frame->pts);
+		TRACE_PROBE3(convert_end, this, frame->pts, convert_time.elapsed());
+	} else {
+#ifdef _DEBUG
+		ScopeProfiler profile("convert");
+#endif
+		wall_time_scope wall_time(_stats.time_convert);
+
+		vframe = pop_free_frame(); // Retrieve an empty frame.
 
 		vframe->height          = _context->height;
 		vframe->format          = _context->pix_fmt;
@@ -1068,24 +2160,39 @@ bool obsffmpeg::encoder::video_encode(encoder_frame* frame, encoder_packet* pack
 		vframe->colorspace      = _context->colorspace;
 		vframe->color_primaries = _context->color_primaries;
 		vframe->color_trc       = _context->color_trc;
-		vframe->pts             = frame->pts;
+		prepare_frame(vframe.get(), frame->pts);
 
 		if ((_swscale.is_source_full_range() == _swscale.is_target_full_range())
 		    && (_swscale.get_source_colorspace() == _swscale.get_target_colorspace())
 		    && (_swscale.get_source_format() == _swscale.get_target_format())) {
 			copy_data(frame, vframe.get());
 		} else {
-			int res = _swscale.convert(reinterpret_cast<uint8_t**>(frame->data),
-			                           reinterpret_cast<int*>(frame->linesize), 0, _context->height,
-			                           vframe->data, vframe->linesize);
+			int res = _converter->convert(reinterpret_cast<uint8_t**>(frame->data),
+			                              reinterpret_cast<int*>(frame->linesize), 0, _context->height,
+			                              vframe->data, vframe->linesize);
 			if (res <= 0) {
 				PLOG_ERROR("Failed to convert frame: %s (%ld).",
 				           ffmpeg::tools::get_error_description(res), res);
 				return false;
 			}
 		}
+		TRACE_PROBE3(convert_end, this, frame->pts, convert_time.elapsed());
+	}
+
+	// Work that does not change the output is the first to go under load.
+	if (_shed < obsffmpeg::shed_level::AUXILIARY) {
+		if (_thumbnailer)
+			_thumbnailer->push(vframe);
+
+		if (_shadow)
+			_shadow->push(vframe);
+	} else if (_shadow) {
+		_shadow->skip();
 	}
 
+	if (_frame_tap)
+		_frame_tap->push(vframe.get());
+
 	if (!encode_avframe(vframe, packet, received_packet))
 		return false;
 
@@ -1101,6 +2208,26 @@ bool obsffmpeg::encoder::video_encode_texture(uint32_t handle, int64_t pts, uint
 		return false;
 	}
 
+	if (_failed) {
+		*next_lock_key = lock_key;
+		return false;
+	}
+
+	obsffmpeg::threading::cpu_time_scope cpu_time(_cpu_time_self);
+	wall_time_scope                      wall_time(_stats.time_encode);
+	_stats.frames++;
+	TRACE_PROBE2(frame, this, pts);
+
+	if (needs_reconfigure())
+		reconfigure();
+
+	if (skip_frame(pts)) {
+		TRACE_PROBE3(drop, this, pts, static_cast<int>(trace_drop::DECIMATION));
+		*next_lock_key   = lock_key;
+		*received_packet = false;
+		return true;
+	}
+
 	std::shared_ptr<AVFrame> vframe = pop_free_frame();
 	_hwinst->copy_from_obs(_context->hw_frames_ctx, handle, lock_key, next_lock_key, vframe);
 
@@ -1108,7 +2235,7 @@ bool obsffmpeg::encoder::video_encode_texture(uint32_t handle, int64_t pts, uint
 	vframe->colorspace      = _context->colorspace;
 	vframe->color_primaries = _context->color_primaries;
 	vframe->color_trc       = _context->color_trc;
-	vframe->pts             = pts;
+	prepare_frame(vframe.get(), pts);
 
 	if (!encode_avframe(vframe, packet, received_packet))
 		return false;
@@ -1124,54 +2251,71 @@ int obsffmpeg::encoder::receive_packet(bool* received_packet, struct encoder_pac
 
 	av_packet_unref(&_current_packet);
 
-	{
-		auto gctx = obsffmpeg::obs_graphics();
-		res       = avcodec_receive_packet(_context, &_current_packet);
-	}
-	if (res != 0) {
-		return res;
-	}
+	if (_pending_packets.size() > 0) {
+		// Packets left over from a reconfigured context are returned first, in order.
+		av_packet_move_ref(&_current_packet, _pending_packets.front().get());
+		_pending_packets.pop();
+	} else {
+		if (_parallel) {
+			// Only wait when no context is free, which keeps latency at one frame per context.
+			res = _parallel->receive_packet(&_current_packet, _parallel->is_full());
+		} else {
+			auto gctx = obsffmpeg::obs_graphics();
+			res       = avcodec_receive_packet(_context, &_current_packet);
+		}
+		if (res != 0) {
+			return res;
+		}
 
-	if (!_have_first_frame) {
-		if (_codec->id == AV_CODEC_ID_H264) {
-			uint8_t* tmp_packet;
-			uint8_t* tmp_header;
-			uint8_t* tmp_sei;
-			size_t   sz_packet, sz_header, sz_sei;
+		if (!_have_first_frame) {
+			if (_codec->id == AV_CODEC_ID_H264) {
+				uint8_t* tmp_packet;
+				uint8_t* tmp_header;
+				uint8_t* tmp_sei;
+				size_t   sz_packet, sz_header, sz_sei;
 
-			obs_extract_avc_headers(_current_packet.data, _current_packet.size, &tmp_packet, &sz_packet,
-			                        &tmp_header, &sz_header, &tmp_sei, &sz_sei);
+				obs_extract_avc_headers(_current_packet.data, _current_packet.size, &tmp_packet,
+				                        &sz_packet, &tmp_header, &sz_header, &tmp_sei, &sz_sei);
 
-			if (sz_header) {
-				_extra_data.resize(sz_header);
-				std::memcpy(_extra_data.data(), tmp_header, sz_header);
-			}
+				if (sz_header) {
+					_extra_data.resize(sz_header);
+					std::memcpy(_extra_data.data(), tmp_header, sz_header);
+				}
 
-			if (sz_sei) {
-				_sei_data.resize(sz_sei);
-				std::memcpy(_sei_data.data(), tmp_sei, sz_sei);
-			}
+				if (sz_sei) {
+					_sei_data.resize(sz_sei);
+					std::memcpy(_sei_data.data(), tmp_sei, sz_sei);
+				}
 
-			// Not required, we only need the Extra Data and SEI Data anyway.
-			//std::memcpy(_current_packet.data, tmp_packet, sz_packet);
-			//_current_packet.size = static_cast<int>(sz_packet);
+				// Not required, we only need the Extra Data and SEI Data anyway.
+				//std::memcpy(_current_packet.data, tmp_packet, sz_packet);
+				//_current_packet.size = static_cast<int>(sz_packet);
+
+				bfree(tmp_packet);
+				bfree(tmp_header);
+				bfree(tmp_sei);
+			} else if (_codec->id == AV_CODEC_ID_HEVC) {
+				obsffmpeg::codecs::hevc::extract_header_sei(_current_packet.data, _current_packet.size,
+				                                            _extra_data, _sei_data);
+			} else if (_context->extradata != nullptr) {
+				_extra_data.resize(_context->extradata_size);
+				std::memcpy(_extra_data.data(), _context->extradata, _context->extradata_size);
+			}
+			_have_first_frame = true;
 
-			bfree(tmp_packet);
-			bfree(tmp_header);
-			bfree(tmp_sei);
-		} else if (_codec->id == AV_CODEC_ID_HEVC) {
-			obsffmpeg::codecs::hevc::extract_header_sei(_current_packet.data, _current_packet.size,
-			                                            _extra_data, _sei_data);
-		} else if (_context->extradata != nullptr) {
-			_extra_data.resize(_context->extradata_size);
-			std::memcpy(_extra_data.data(), _context->extradata, _context->extradata_size);
+			if (_packet_bus && (_extra_data.size() > 0))
+				_packet_bus->publish_extradata(_extra_data.data(), _extra_data.size());
 		}
-		_have_first_frame = true;
-	}
 
-	// Allow Handler Post-Processing
-	if (_handler)
-		_handler->process_avpacket(_current_packet, _codec, _context);
+		// Allow Handler Post-Processing
+		if (_handler)
+			_handler->process_avpacket(_current_packet, _codec, _context);
+		rescale_packet(&_current_packet);
+
+		auto used = pop_used_frame();
+		if (!_strip_converter)
+			push_free_frame(used);
+	}
 
 	packet->type          = OBS_ENCODER_VIDEO;
 	packet->pts           = _current_packet.pts;
@@ -1179,23 +2323,110 @@ int obsffmpeg::encoder::receive_packet(bool* received_packet, struct encoder_pac
 	packet->data          = _current_packet.data;
 	packet->size          = _current_packet.size;
 	packet->keyframe      = !!(_current_packet.flags & AV_PKT_FLAG_KEY);
-	packet->drop_priority = packet->keyframe ? 0 : 1;
+	packet->priority      = get_packet_priority(packet->pts);
+	if (packet->keyframe)
+		packet->priority = OBS_NAL_PRIORITY_HIGHEST;
+	packet->drop_priority = packet->priority;
 	*received_packet      = true;
 
-	push_free_frame(pop_used_frame());
+	if (_stats.packets == 0) {
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		    std::chrono::high_resolution_clock::now() - _created);
+		_stats.time_first_packet = static_cast<uint64_t>(elapsed.count());
+		PLOG_INFO("[%s] First packet %.3f ms after creation.", _codec->name,
+		          static_cast<double_t>(_stats.time_first_packet) / 1000000.0);
+	}
+	_stats.packets++;
+	_stats.bytes += static_cast<uint64_t>(packet->size);
+	{
+		int      size = 0;
+		uint8_t* data = av_packet_get_side_data(&_current_packet, AV_PKT_DATA_QUALITY_STATS, &size);
+		if (data && (size >= 4)) {
+			_stats.quality += AV_RL32(data);
+			_stats.quality_packets++;
+		}
+	}
+	TRACE_PROBE5(packet, this, packet->pts, packet->dts, packet->size, packet->priority);
+
+	// Timestamps are part of the output, so they are part of the checksum.
+	if (_deterministic_threads > 0) {
+		const AVCRC* table         = av_crc_get_table(AV_CRC_32_IEEE);
+		int64_t      timestamps[2] = {packet->pts, packet->dts};
+		_packet_checksum =
+		    av_crc(table, _packet_checksum, reinterpret_cast<const uint8_t*>(timestamps), sizeof(timestamps));
+		_packet_checksum = av_crc(table, _packet_checksum, packet->data, packet->size);
+	}
+
+	if (_packet_bus)
+		_packet_bus->publish(packet->data, packet->size, packet->pts, packet->dts, packet->keyframe,
+		                     static_cast<uint32_t>(packet->priority));
+
+	if (_packet_trace.is_open()) {
+		auto time = std::chrono::duration<double_t, std::milli>(std::chrono::high_resolution_clock::now()
+		                                                         - _packet_trace_start);
+		_packet_trace << "{\"time\":" << time.count() << ",\"pts\":" << packet->pts
+		              << ",\"dts\":" << packet->dts << ",\"timebase\":["
+		              << (_context->time_base.num / _decimation) << "," << _context->time_base.den
+		              << "],\"size\":" << packet->size
+		              << ",\"keyframe\":" << (packet->keyframe ? "true" : "false")
+		              << ",\"priority\":" << packet->drop_priority << "}\n";
+	}
 
 	return res;
 }
 
+int obsffmpeg::encoder::queue_packet()
+{
+	std::shared_ptr<AVPacket> pkt =
+	    std::shared_ptr<AVPacket>(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+	int res;
+	if (_parallel) {
+		res = _parallel->receive_packet(pkt.get(), true);
+	} else {
+		auto gctx = obsffmpeg::obs_graphics();
+		res       = avcodec_receive_packet(_context, pkt.get());
+	}
+	if (res != 0)
+		return res;
+
+	// Returned by receive_packet after the current packet, same as packets of a reconfigured context.
+	if (_handler)
+		_handler->process_avpacket(*pkt, _codec, _context);
+	rescale_packet(pkt.get());
+	_pending_packets.push(pkt);
+
+	auto used = pop_used_frame();
+	if (!_strip_converter && !_hwinst)
+		push_free_frame(used);
+	return 0;
+}
+
 int obsffmpeg::encoder::send_frame(std::shared_ptr<AVFrame> const frame)
 {
 	int res = 0;
-	{
+	if (_parallel) {
+		res = _parallel->send_frame(frame.get());
+	} else {
 		auto gctx = obsffmpeg::obs_graphics();
 		res       = avcodec_send_frame(_context, frame.get());
 	}
 	if (res == 0) {
+		// The codec keeps its own reference if it needs one, and the strip converter copies its target
+		// as long as any reference is alive.
+		if (_strip_converter)
+			av_frame_unref(frame.get());
+
 		push_used_frame(frame);
+		_count_send_frames++;
+
+		// Remember the layer of each frame by its timestamp in canvas frames, which survives reconfiguration.
+		if (_temporal_pattern.size() > 0) {
+			_temporal_layers[frame->pts * _decimation + _timestamp_offset] =
+			    _temporal_pattern[_temporal_index++ % _temporal_pattern.size()];
+			while (_temporal_layers.size() > 256) {
+				_temporal_layers.erase(_temporal_layers.begin());
+			}
+		}
 	}
 
 	return res;
@@ -1211,18 +2442,22 @@ bool obsffmpeg::encoder::encode_avframe(std::shared_ptr<AVFrame> frame, encoder_
 	bool recv_packet = false;
 	bool should_lag  = (_count_send_frames >= _lag_in_frames);
 
+	// Deterministic mode waits for the codec however long it takes, as giving up would depend on timing.
 	auto loop_begin = std::chrono::high_resolution_clock::now();
 	auto loop_end   = loop_begin + std::chrono::milliseconds(50);
 
 	while ((!sent_frame || (should_lag && !recv_packet))
-	       && !(std::chrono::high_resolution_clock::now() > loop_end)) {
+	       && ((_deterministic_threads > 0) || !(std::chrono::high_resolution_clock::now() > loop_end))) {
 		bool eagain_is_stupid = false;
 
 		if (!sent_frame) {
 #ifdef _DEBUG
 			ScopeProfiler profile_inner("send");
 #endif
-			int res = send_frame(frame);
+			wall_time_scope wall_time(_stats.time_send);
+			int             res = send_frame(frame);
+			TRACE_PROBE4(send_frame, this, frame->pts, res,
+			             TRACE_ENABLED(send_frame) ? wall_time.elapsed() : 0);
 			switch (res) {
 			case 0:
 				sent_frame = true;
@@ -1231,20 +2466,31 @@ bool obsffmpeg::encoder::encode_avframe(std::shared_ptr<AVFrame> frame, encoder_
 			case AVERROR(EAGAIN):
 				// This means we should call receive_packet again, but what do we do with that data?
 				// Why can't we queue on both? Do I really have to implement threading for this stuff?
-				if (*received_packet == true) {
+				if ((*received_packet == true) && (_deterministic_threads > 0)) {
+					// Park the next packet to make room instead of skipping the frame.
+					int qres = queue_packet();
+					if (qres == 0)
+						break;
+					PLOG_ERROR("Failed to make room for frame: %s (%ld).",
+					           ffmpeg::tools::get_error_description(qres), qres);
+					return handle_encode_error();
+				} else if (*received_packet == true) {
 					PLOG_WARNING("Skipped frame due to EAGAIN when a packet was already returned.");
+					TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(trace_drop::BUSY));
 					sent_frame = true;
 				}
 				eagain_is_stupid = true;
 				break;
 			case AVERROR(EOF):
 				PLOG_ERROR("Skipped frame due to end of stream.");
+				TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(trace_drop::END));
 				sent_frame = true;
 				break;
 			default:
 				PLOG_ERROR("Failed to encode frame: %s (%ld).",
 				           ffmpeg::tools::get_error_description(res), res);
-				return false;
+				TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(trace_drop::FAILURE));
+				return handle_encode_error();
 			}
 		}
 
@@ -1252,7 +2498,10 @@ bool obsffmpeg::encoder::encode_avframe(std::shared_ptr<AVFrame> frame, encoder_
 #ifdef _DEBUG
 			ScopeProfiler profile_inner("recieve");
 #endif
-			int res = receive_packet(received_packet, packet);
+			wall_time_scope wall_time(_stats.time_receive);
+			int             res = receive_packet(received_packet, packet);
+			TRACE_PROBE3(receive_packet, this, res,
+			             TRACE_ENABLED(receive_packet) ? wall_time.elapsed() : 0);
 			switch (res) {
 			case 0:
 				recv_packet = true;
@@ -1267,13 +2516,13 @@ bool obsffmpeg::encoder::encode_avframe(std::shared_ptr<AVFrame> frame, encoder_
 				}
 				if (eagain_is_stupid) {
 					PLOG_ERROR("Both send and recieve returned EAGAIN, encoder is broken.");
-					return false;
+					return handle_encode_error();
 				}
 				break;
 			default:
 				PLOG_ERROR("Failed to receive packet: %s (%ld).",
 				           ffmpeg::tools::get_error_description(res), res);
-				return false;
+				return handle_encode_error();
 			}
 		}
 
@@ -1282,9 +2531,63 @@ bool obsffmpeg::encoder::encode_avframe(std::shared_ptr<AVFrame> frame, encoder_
 		}
 	}
 
-	if (!sent_frame)
+	if (!sent_frame && !_strip_converter)
 		push_free_frame(frame);
 
+	// A codec that does not take frames anymore is stalled, which counts like an error when there is a fallback
+	// to replace it with. Without one, the frame is skipped and the codec gets another chance.
+	if (!sent_frame) {
+		TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(trace_drop::STALL));
+		if (_failover_codec && !handle_encode_error())
+			return false;
+	} else {
+		_failover_errors = 0;
+	}
+
+	// Latency of the previous encode call, from the running total like the soak monitor does.
+	if (_latency_last != 0) {
+		size_t step = static_cast<size_t>((_stats.time_encode - _latency_last) / ST_LATENCY_STEP);
+		_latency_histogram[std::min<size_t>(step, ST_LATENCY_STEPS - 1)]++;
+	}
+	_latency_last = _stats.time_encode;
+
+	if (_soak) {
+		_soak->record(_stats.time_encode);
+
+		// Churn rebuilds the codec, converter and frame pools over and over, as that is where leaks hide.
+		if ((_soak_churn > 0) && ((_stats.frames % _soak_churn) == 0))
+			_reconfigure_pending = true;
+
+		if (_soak->is_due())
+			_soak->write({{"frames", _stats.frames},
+			              {"allocations", _stats.allocations},
+			              {"reconfigures", _stats.reconfigures},
+			              {"free_frames", _free_frames.size()},
+			              {"used_frames", _used_frames.size()},
+			              {"pending_packets", _pending_packets.size()}});
+	}
+
+	if (_shedder) {
+		auto voi = video_output_get_info(obs_encoder_video(_self));
+		_shedder->record(_stats.time_encode, _stats.frames,
+		                 std::chrono::nanoseconds(1000000000ll * voi->fps_den / voi->fps_num));
+
+		// Levels that change the output wait for the next key-frame, like settings do.
+		obsffmpeg::shed_level level = _shedder->get_level();
+		if (level != _shed) {
+			if (std::max(level, obsffmpeg::shed_level::AUXILIARY)
+			    != std::max(_shed, obsffmpeg::shed_level::AUXILIARY)) {
+				_reconfigure_pending = true;
+			} else {
+				_shed = level;
+				_shedder->set_applied(level);
+			}
+		}
+	}
+
+	if ((std::chrono::high_resolution_clock::now() - _stats_logged_time) > std::chrono::seconds(60))
+		log_stats();
+
 	return true;
 }
 
@@ -1303,8 +2606,45 @@ const AVCodecContext* obsffmpeg::encoder::get_avcodeccontext()
 	return _context;
 }
 
-void obsffmpeg::encoder::parse_ffmpeg_commandline(std::string text)
+void obsffmpeg::encoder::set_temporal_pattern(std::vector<uint32_t> pattern)
+{
+	_temporal_pattern = pattern;
+}
+
+std::shared_ptr<obsffmpeg::threadpool> obsffmpeg::encoder::get_threadpool()
 {
+	return _threadpool;
+}
+
+void obsffmpeg::encoder::execute(size_t count, std::function<void(size_t job, size_t thread)> job)
+{
+	// CPU time is sampled at job boundaries. Thread 0 is the calling thread, which is already accounted for.
+	size_t threads = static_cast<size_t>(_context->thread_count);
+	_threadpool->execute(count, threads, [this, &job](size_t idx, size_t thread) {
+		if (thread == 0) {
+			job(idx, thread);
+		} else {
+			obsffmpeg::threading::cpu_time_scope cpu_time(_cpu_time_pool);
+			job(idx, thread);
+		}
+	});
+}
+
+obsffmpeg::encoder_stats obsffmpeg::encoder::get_stats()
+{
+	encoder_stats stats  = _stats;
+	stats.cpu_time_self  = _cpu_time_self;
+	stats.cpu_time_pool  = _cpu_time_pool;
+	stats.cpu_time_codec = get_codec_cpu_time();
+	stats.cpu_time_codec += _cpu_time_codec_closed;
+	return stats;
+}
+
+void obsffmpeg::encoder::parse_ffmpeg_commandline(std::string text, AVCodecContext* context)
+{
+	if (!context)
+		context = _context;
+
 	// Steps to properly parse a command line:
 	// 1. Split by space and package by quotes.
 	// 2. Parse each resulting option individually.
@@ -1417,7 +2757,7 @@ void obsffmpeg::encoder::parse_ffmpeg_commandline(std::string text)
 			std::string key   = opt.substr(1, eq_at - cstr - 1);
 			std::string value = opt.substr(eq_at - cstr + 1);
 
-			int res = av_opt_set(_context, key.c_str(), value.c_str(), AV_OPT_SEARCH_CHILDREN);
+			int res = av_opt_set(context, key.c_str(), value.c_str(), AV_OPT_SEARCH_CHILDREN);
 			if (res < 0) {
 				PLOG_WARNING("Option '%s' (key: '%s', value: '%s') encountered error: %s", opt.c_str(),
 				             key.c_str(), value.c_str(), ffmpeg::tools::get_error_description(res));
@@ -21,15 +21,31 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <stack>
 #include <thread>
 #include <vector>
+#include "analysis.hpp"
 #include "ffmpeg/avframe-queue.hpp"
+#include "ffmpeg/converter.hpp"
+#include "ffmpeg/frame-parallel.hpp"
+#include "ffmpeg/strip-converter.hpp"
 #include "ffmpeg/swscale.hpp"
+#include "ffmpeg/tools.hpp"
 #include "hwapi/base.hpp"
+#include "ipc/frame-tap.hpp"
+#include "ipc/packet-bus.hpp"
+#include "shadow.hpp"
+#include "shedding.hpp"
+#include "soak.hpp"
+#include "threading.hpp"
+#include "thumbnailer.hpp"
 #include "ui/handler.hpp"
 
 extern "C" {
@@ -48,6 +64,25 @@ namespace obsffmpeg {
 		unsupported_gpu_exception(const std::string& reason) : runtime_error(reason) {}
 	};
 
+	struct encoder_stats {
+		uint64_t frames            = 0;
+		uint64_t packets           = 0;
+		uint64_t cpu_time_self     = 0; // Encode calls on the OBS encoder thread, in nanoseconds.
+		uint64_t cpu_time_pool     = 0; // Shared pool jobs submitted by the encoder, in nanoseconds.
+		uint64_t cpu_time_codec    = 0; // Threads spawned by the codec, in nanoseconds.
+		uint64_t time_encode       = 0; // Wall time spent in encode calls, in nanoseconds.
+		uint64_t time_convert      = 0; // Wall time spent converting frames, in nanoseconds.
+		uint64_t time_send         = 0; // Wall time spent sending frames to the codec, in nanoseconds.
+		uint64_t time_receive      = 0; // Wall time spent receiving packets from the codec, in nanoseconds.
+		uint64_t allocations       = 0; // Frames allocated because the free frame stack was empty.
+		uint64_t failovers         = 0; // Times the codec was replaced by the fallback after errors.
+		uint64_t time_first_packet = 0; // Wall time from creation to the first packet, in nanoseconds.
+		uint64_t reconfigures      = 0; // Times the codec context was rebuilt in place.
+		uint64_t bytes             = 0;
+		uint64_t quality           = 0; // Sum of the quality packets reported, in lambda.
+		uint64_t quality_packets   = 0; // Packets that reported a quality.
+	};
+
 	struct encoder_info {
 		std::string      uid;
 		std::string      codec;
@@ -91,8 +126,16 @@ namespace obsffmpeg {
 		std::shared_ptr<obsffmpeg::hwapi::base>     _hwapi;
 		std::shared_ptr<obsffmpeg::hwapi::instance> _hwinst;
 
-		ffmpeg::swscale _swscale;
-		AVPacket        _current_packet;
+		ffmpeg::swscale                          _swscale;
+		std::shared_ptr<ffmpeg::converter>       _converter;
+		std::shared_ptr<ffmpeg::strip_converter> _strip_converter;
+		std::shared_ptr<ffmpeg::frame_parallel>  _parallel;
+		AVPacket                                 _current_packet;
+
+		// Threading
+		thread_priority              _priority;
+		std::shared_ptr<threadpool>  _threadpool;
+		std::map<uint64_t, uint64_t> _codec_threads; // Highest CPU time seen of each codec thread.
 
 		size_t _lag_in_frames;
 		size_t _count_send_frames;
@@ -102,14 +145,107 @@ namespace obsffmpeg {
 		std::vector<uint8_t> _extra_data;
 		std::vector<uint8_t> _sei_data;
 
+		// HDR
+		bool                        _hdr;
+		ffmpeg::tools::hdr_metadata _hdr_metadata;
+
 		// Frame Stack and Queue
 		std::stack<std::shared_ptr<AVFrame>>           _free_frames;
 		std::queue<std::shared_ptr<AVFrame>>           _used_frames;
 		std::chrono::high_resolution_clock::time_point _free_frames_last_used;
 
+		// Statistics
+		encoder_stats                                  _stats;
+		encoder_stats                                  _stats_logged;
+		std::chrono::high_resolution_clock::time_point _stats_logged_time;
+		std::atomic_uint64_t                           _cpu_time_self;
+		std::atomic_uint64_t                           _cpu_time_pool;
+		uint64_t                                       _cpu_time_codec_closed;
+		std::vector<uint32_t>                          _latency_histogram;
+		uint64_t                                       _latency_last;
+		std::ofstream                                  _packet_trace;
+		std::chrono::high_resolution_clock::time_point _packet_trace_start;
+		std::shared_ptr<ipc::packet_bus>               _packet_bus;
+		std::shared_ptr<soak_monitor>                  _soak;
+		uint64_t                                       _soak_churn;
+
+		// Deterministic Mode
+		size_t   _deterministic_threads;
+		uint32_t _packet_checksum;
+
+		// Decimation
+		int64_t _decimation;
+		int64_t _decimation_last_pts;
+
+		// Analysis
+		std::shared_ptr<analysis>              _analysis;
+		std::shared_ptr<const analysis_result> _analysis_current;
+		bool                                   _scene_change_pending;
+		int64_t                                _scene_keyframe_pts;
+
+		// Thumbnails
+		std::shared_ptr<thumbnailer> _thumbnailer;
+
+		// Frame Tap
+		std::shared_ptr<ipc::frame_tap> _frame_tap;
+
+		// Shadow Encoding
+		std::shared_ptr<shadow_encoder> _shadow;
+		std::string                     _shadow_options;
+
+		// Temporal Layers
+		std::vector<uint32_t>       _temporal_pattern;
+		size_t                      _temporal_index;
+		std::map<int64_t, uint32_t> _temporal_layers;
+
+		// Reconfiguration
+		bool                                  _reconfigure_pending;
+		std::queue<std::shared_ptr<AVPacket>> _pending_packets;
+		int64_t                               _last_dts;
+		int64_t                               _timestamp_offset;
+		bool                                  _timestamp_offset_pending;
+		bool                                  _failed;
+
+		// Failover
+		const AVCodec* _failover_codec;
+		size_t         _failover_errors;
+		bool           _failover_active;
+		int64_t        _failover_bit_rate;
+		int64_t        _failover_max_rate;
+		int            _failover_buffer_size;
+		int            _failover_gop_size;
+
+		// Fast Start
+		bool                                           _fast_start;
+		std::chrono::high_resolution_clock::time_point _created;
+
+		// Load Shedding
+		std::shared_ptr<load_shedder> _shedder;
+		shed_level                    _shed;
+
 		void initialize_sw(obs_data_t* settings);
 		void initialize_hw(obs_data_t* settings);
 
+		void initialize_context(obs_data_t* settings);
+		void finalize_context(bool keep_packets);
+		void abandon_context();
+
+		bool skip_frame(int64_t pts);
+		void prepare_frame(AVFrame* frame, int64_t pts);
+		void rescale_packet(AVPacket* packet);
+
+		uint32_t get_packet_priority(int64_t pts);
+
+		bool needs_reconfigure();
+		void reconfigure();
+
+		bool handle_encode_error();
+		void failover();
+
+		uint64_t get_codec_cpu_time();
+		void     log_stats();
+		void     write_stats();
+
 		void                     push_free_frame(std::shared_ptr<AVFrame> frame);
 		std::shared_ptr<AVFrame> pop_free_frame();
 
@@ -147,6 +283,8 @@ namespace obsffmpeg {
 
 		int receive_packet(bool* received_packet, struct encoder_packet* packet);
 
+		int queue_packet();
+
 		int send_frame(std::shared_ptr<AVFrame> frame);
 
 		bool encode_avframe(std::shared_ptr<AVFrame> frame, struct encoder_packet* packet,
@@ -159,6 +297,14 @@ namespace obsffmpeg {
 
 		const AVCodecContext* get_avcodeccontext();
 
-		void parse_ffmpeg_commandline(std::string text);
+		std::shared_ptr<obsffmpeg::threadpool> get_threadpool();
+
+		void set_temporal_pattern(std::vector<uint32_t> pattern);
+
+		void execute(size_t count, std::function<void(size_t job, size_t thread)> job);
+
+		encoder_stats get_stats();
+
+		void parse_ffmpeg_commandline(std::string text, AVCodecContext* context = nullptr);
 	};
 } // namespace obsffmpeg
@@ -0,0 +1,214 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "converter-libyuv.hpp"
+#include <stdexcept>
+#include <libyuv.h>
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/pixdesc.h>
+#pragma warning(pop)
+}
+
+static bool is_bt601(AVColorSpace space)
+{
+	return (space == AVCOL_SPC_BT470BG) || (space == AVCOL_SPC_SMPTE170M);
+}
+
+// libyuv names RGB formats after their order in a 32-bit word, FFmpeg after their order in memory, so FFmpeg's
+// BGRA is libyuv's ARGB.
+#define LIBYUV_FUNCTION(name)                                                                                  \
+	static int name(const uint8_t* const s[], const int ss[], uint8_t* const t[], const int ts[], int w, int h)
+
+LIBYUV_FUNCTION(i420_to_nv12)
+{
+	return libyuv::I420ToNV12(s[0], ss[0], s[1], ss[1], s[2], ss[2], t[0], ts[0], t[1], ts[1], w, h);
+}
+
+LIBYUV_FUNCTION(nv12_to_i420)
+{
+	return libyuv::NV12ToI420(s[0], ss[0], s[1], ss[1], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(i444_to_i420)
+{
+	return libyuv::I444ToI420(s[0], ss[0], s[1], ss[1], s[2], ss[2], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(i422_to_i420)
+{
+	return libyuv::I422ToI420(s[0], ss[0], s[1], ss[1], s[2], ss[2], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(yuy2_to_i420)
+{
+	return libyuv::YUY2ToI420(s[0], ss[0], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(uyvy_to_i420)
+{
+	return libyuv::UYVYToI420(s[0], ss[0], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(bgra_to_i420)
+{
+	return libyuv::ARGBToI420(s[0], ss[0], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(bgra_to_j420)
+{
+	return libyuv::ARGBToJ420(s[0], ss[0], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+LIBYUV_FUNCTION(bgra_to_nv12)
+{
+	return libyuv::ARGBToNV12(s[0], ss[0], t[0], ts[0], t[1], ts[1], w, h);
+}
+
+LIBYUV_FUNCTION(rgba_to_i420)
+{
+	return libyuv::ABGRToI420(s[0], ss[0], t[0], ts[0], t[1], ts[1], t[2], ts[2], w, h);
+}
+
+// Functions for 16-bit samples take strides in samples instead of bytes.
+#if defined(LIBYUV_VERSION) && (LIBYUV_VERSION >= 1875)
+#define HAVE_LIBYUV_P010
+#define S16(idx) reinterpret_cast<const uint16_t*>(s[idx]), (ss[idx] / 2)
+#define T16(idx) reinterpret_cast<uint16_t*>(t[idx]), (ts[idx] / 2)
+
+LIBYUV_FUNCTION(i010_to_p010)
+{
+	return libyuv::I010ToP010(S16(0), S16(1), S16(2), T16(0), T16(1), w, h);
+}
+
+LIBYUV_FUNCTION(p010_to_i010)
+{
+	return libyuv::P010ToI010(S16(0), S16(1), T16(0), T16(1), T16(2), w, h);
+}
+
+#undef T16
+#undef S16
+#endif
+
+#undef LIBYUV_FUNCTION
+
+ffmpeg::libyuv_converter::libyuv_converter(ffmpeg::swscale& config)
+    : _width(config.get_source_width()), _source_format(config.get_source_format()),
+      _target_format(config.get_target_format()), _function(nullptr)
+{
+	if ((config.get_source_width() != config.get_target_width())
+	    || (config.get_source_height() != config.get_target_height()))
+		throw std::invalid_argument("scaling is not supported");
+
+	// Conversions between YUV formats only move samples around, so they can't change the color.
+	bool same_color = (config.is_source_full_range() == config.is_target_full_range())
+	                  && (config.get_source_colorspace() == config.get_target_colorspace());
+	bool full_range = config.is_target_full_range();
+	bool bt601      = is_bt601(config.get_target_colorspace());
+
+	switch (_source_format) {
+	case AV_PIX_FMT_YUV420P:
+		if (same_color && (_target_format == AV_PIX_FMT_NV12))
+			_function = i420_to_nv12;
+		break;
+	case AV_PIX_FMT_NV12:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = nv12_to_i420;
+		break;
+	case AV_PIX_FMT_YUV444P:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = i444_to_i420;
+		break;
+	case AV_PIX_FMT_YUV422P:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = i422_to_i420;
+		break;
+#ifdef HAVE_LIBYUV_P010
+	case AV_PIX_FMT_YUV420P10LE:
+		if (same_color && (_target_format == AV_PIX_FMT_P010LE))
+			_function = i010_to_p010;
+		break;
+	case AV_PIX_FMT_P010LE:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P10LE))
+			_function = p010_to_i010;
+		break;
+#endif
+	case AV_PIX_FMT_YUYV422:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = yuy2_to_i420;
+		break;
+	case AV_PIX_FMT_UYVY422:
+		if (same_color && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = uyvy_to_i420;
+		break;
+	case AV_PIX_FMT_BGRA:
+	case AV_PIX_FMT_BGR0:
+		if (bt601 && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = full_range ? bgra_to_j420 : bgra_to_i420;
+		else if (bt601 && !full_range && (_target_format == AV_PIX_FMT_NV12))
+			_function = bgra_to_nv12;
+		break;
+	case AV_PIX_FMT_RGBA:
+	case AV_PIX_FMT_RGB0:
+		if (bt601 && !full_range && (_target_format == AV_PIX_FMT_YUV420P))
+			_function = rgba_to_i420;
+		break;
+	default:
+		break;
+	}
+
+	if (!_function)
+		throw std::invalid_argument("conversion is not supported");
+}
+
+ffmpeg::libyuv_converter::~libyuv_converter() {}
+
+const char* ffmpeg::libyuv_converter::get_name()
+{
+	return "libyuv";
+}
+
+int32_t ffmpeg::libyuv_converter::convert(const uint8_t* const source_data[], const int source_stride[],
+                                          int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+                                          const int target_stride[])
+{
+	// Slices start at the same row in the source and the target, like they do with swscale.
+	const AVPixFmtDescriptor* src       = av_pix_fmt_desc_get(_source_format);
+	const AVPixFmtDescriptor* dst       = av_pix_fmt_desc_get(_target_format);
+	const uint8_t*            source[4] = {0};
+	uint8_t*                  target[4] = {0};
+	for (size_t plane = 0; plane < 4; plane++) {
+		uint32_t src_shift = (plane == 1 || plane == 2) ? src->log2_chroma_h : 0;
+		uint32_t dst_shift = (plane == 1 || plane == 2) ? dst->log2_chroma_h : 0;
+		if (source_data[plane])
+			source[plane] = source_data[plane]
+			                + static_cast<ptrdiff_t>(source_row >> src_shift) * source_stride[plane];
+		if (target_data[plane])
+			target[plane] = target_data[plane]
+			                + static_cast<ptrdiff_t>(source_row >> dst_shift) * target_stride[plane];
+	}
+
+	if (_function(source, source_stride, target, target_stride, static_cast<int>(_width), source_rows) != 0)
+		return 0;
+	return source_rows;
+}
@@ -0,0 +1,47 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "converter.hpp"
+
+namespace ffmpeg {
+	// Hand-tuned libyuv kernels for the common paths between I420, NV12, packed YUV and 8-bit RGB. Only
+	// converts without scaling, and RGB sources only to BT.601, as libyuv has no other matrices for them.
+	class libyuv_converter : public converter {
+		typedef int (*function_t)(const uint8_t* const source[], const int source_stride[],
+		                          uint8_t* const target[], const int target_stride[], int width, int height);
+
+		uint32_t      _width;
+		AVPixelFormat _source_format;
+		AVPixelFormat _target_format;
+		function_t    _function;
+
+		public:
+		libyuv_converter(ffmpeg::swscale& config);
+		virtual ~libyuv_converter();
+
+		virtual const char* get_name() override;
+
+		virtual int32_t convert(const uint8_t* const source_data[], const int source_stride[],
+		                        int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+		                        const int target_stride[]) override;
+	};
+} // namespace ffmpeg
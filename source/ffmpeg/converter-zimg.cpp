@@ -0,0 +1,186 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "converter-zimg.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#pragma warning(pop)
+}
+
+// zimg wants 64 byte aligned buffers and strides on CPUs with AVX-512, and less on others.
+#define ZIMG_BUFFER_ALIGNMENT 64
+
+static void setup_format(zimg_image_format& format, AVPixelFormat pix_fmt, uint32_t width, uint32_t height,
+                         bool full_range, AVColorSpace space)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pix_fmt);
+	if (!desc)
+		throw std::invalid_argument("unknown pixel format");
+
+	// Only planar YUV with one component per plane and native endian samples in the low bits.
+	if (!(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE))
+	    || (desc->nb_components != 3))
+		throw std::invalid_argument("pixel format is not supported");
+	for (int idx = 0; idx < 3; idx++) {
+		if ((desc->comp[idx].plane != idx) || (desc->comp[idx].shift != 0) || (desc->comp[idx].depth > 16))
+			throw std::invalid_argument("pixel format is not supported");
+	}
+
+	zimg_image_format_default(&format, ZIMG_API_VERSION);
+	format.width        = width;
+	format.height       = height;
+	format.pixel_type   = desc->comp[0].depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE;
+	format.depth        = static_cast<unsigned>(desc->comp[0].depth);
+	format.subsample_w  = desc->log2_chroma_w;
+	format.subsample_h  = desc->log2_chroma_h;
+	format.color_family = ZIMG_COLOR_YUV;
+	format.pixel_range  = full_range ? ZIMG_RANGE_FULL : ZIMG_RANGE_LIMITED;
+	// Both use the code points of ITU-T H.273. Primaries and transfer stay unspecified, so that only the
+	// matrix and range are ever converted.
+	format.matrix_coefficients      = static_cast<zimg_matrix_coefficients_e>(space);
+	format.transfer_characteristics = ZIMG_TRANSFER_UNSPECIFIED;
+	format.color_primaries          = ZIMG_PRIMARIES_UNSPECIFIED;
+}
+
+static bool is_aligned(const uint8_t* const data[], const int stride[])
+{
+	for (size_t plane = 0; plane < 3; plane++) {
+		if ((reinterpret_cast<uintptr_t>(data[plane]) % ZIMG_BUFFER_ALIGNMENT)
+		    || (stride[plane] % ZIMG_BUFFER_ALIGNMENT))
+			return false;
+	}
+	return true;
+}
+
+static std::string get_last_error()
+{
+	char buffer[1024] = {0};
+	zimg_get_last_error(buffer, sizeof(buffer));
+	return std::string(buffer);
+}
+
+void ffmpeg::zimg_converter::allocate(staging& s, AVPixelFormat format, uint32_t width, uint32_t height)
+{
+	int size = av_image_get_buffer_size(format, static_cast<int>(width), static_cast<int>(height),
+	                                    ZIMG_BUFFER_ALIGNMENT);
+	if (size < 0)
+		throw std::invalid_argument("pixel format is not supported");
+	s.buffer.resize(static_cast<size_t>(size) + ZIMG_BUFFER_ALIGNMENT);
+
+	uint8_t* base = s.buffer.data();
+	base += (ZIMG_BUFFER_ALIGNMENT - reinterpret_cast<uintptr_t>(base) % ZIMG_BUFFER_ALIGNMENT)
+	        % ZIMG_BUFFER_ALIGNMENT;
+	if (av_image_fill_arrays(s.data, s.linesize, base, format, static_cast<int>(width), static_cast<int>(height),
+	                         ZIMG_BUFFER_ALIGNMENT)
+	    < 0)
+		throw std::invalid_argument("pixel format is not supported");
+}
+
+ffmpeg::zimg_converter::zimg_converter(ffmpeg::swscale& config)
+    : _width(config.get_source_width()), _height(config.get_source_height()),
+      _source_format(config.get_source_format()), _target_format(config.get_target_format()), _graph(nullptr)
+{
+	if ((config.get_source_width() != config.get_target_width())
+	    || (config.get_source_height() != config.get_target_height()))
+		throw std::invalid_argument("scaling is not supported");
+
+	zimg_image_format source, target;
+	setup_format(source, _source_format, _width, _height, config.is_source_full_range(),
+	             config.get_source_colorspace());
+	setup_format(target, _target_format, _width, _height, config.is_target_full_range(),
+	             config.get_target_colorspace());
+
+	zimg_graph_builder_params params;
+	zimg_graph_builder_params_default(&params, ZIMG_API_VERSION);
+	params.dither_type = ZIMG_DITHER_ERROR_DIFFUSION;
+
+	_graph = zimg_filter_graph_build(&source, &target, &params);
+	if (!_graph)
+		throw std::runtime_error(get_last_error());
+
+	size_t temp_size = 0;
+	if (zimg_filter_graph_get_tmp_size(_graph, &temp_size) != ZIMG_ERROR_SUCCESS) {
+		zimg_filter_graph_free(_graph);
+		throw std::runtime_error(get_last_error());
+	}
+	_temp.resize(temp_size + ZIMG_BUFFER_ALIGNMENT);
+}
+
+ffmpeg::zimg_converter::~zimg_converter()
+{
+	zimg_filter_graph_free(_graph);
+}
+
+const char* ffmpeg::zimg_converter::get_name()
+{
+	return "zimg";
+}
+
+int32_t ffmpeg::zimg_converter::convert(const uint8_t* const source_data[], const int source_stride[],
+                                        int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+                                        const int target_stride[])
+{
+	if ((source_row != 0) || (source_rows != static_cast<int32_t>(_height)))
+		return 0;
+
+	bool source_aligned = is_aligned(source_data, source_stride);
+	bool target_aligned = is_aligned(target_data, target_stride);
+	if (!source_aligned && _source.buffer.empty())
+		allocate(_source, _source_format, _width, _height);
+	if (!target_aligned && _target.buffer.empty())
+		allocate(_target, _target_format, _width, _height);
+	if (!source_aligned)
+		av_image_copy(_source.data, _source.linesize, const_cast<const uint8_t**>(source_data), source_stride,
+		              _source_format, static_cast<int>(_width), static_cast<int>(_height));
+
+	zimg_image_buffer_const source = {};
+	zimg_image_buffer       target = {};
+	source.version                 = ZIMG_API_VERSION;
+	target.version                 = ZIMG_API_VERSION;
+	for (size_t plane = 0; plane < 3; plane++) {
+		source.plane[plane].data   = source_aligned ? source_data[plane] : _source.data[plane];
+		source.plane[plane].stride = source_aligned ? source_stride[plane] : _source.linesize[plane];
+		source.plane[plane].mask   = ZIMG_BUFFER_MAX;
+		target.plane[plane].data   = target_aligned ? target_data[plane] : _target.data[plane];
+		target.plane[plane].stride = target_aligned ? target_stride[plane] : _target.linesize[plane];
+		target.plane[plane].mask   = ZIMG_BUFFER_MAX;
+	}
+
+	char* temp = _temp.data();
+	temp += (ZIMG_BUFFER_ALIGNMENT - reinterpret_cast<uintptr_t>(temp) % ZIMG_BUFFER_ALIGNMENT)
+	        % ZIMG_BUFFER_ALIGNMENT;
+	if (zimg_filter_graph_process(_graph, &source, &target, temp, nullptr, nullptr, nullptr, nullptr)
+	    != ZIMG_ERROR_SUCCESS)
+		return 0;
+
+	if (!target_aligned)
+		av_image_copy(const_cast<uint8_t**>(target_data), const_cast<int*>(target_stride),
+		              const_cast<const uint8_t**>(_target.data), _target.linesize, _target_format,
+		              static_cast<int>(_width), static_cast<int>(_height));
+	return source_rows;
+}
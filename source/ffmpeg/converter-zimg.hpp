@@ -0,0 +1,62 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <vector>
+#include "converter.hpp"
+
+extern "C" {
+#include <zimg.h>
+}
+
+namespace ffmpeg {
+	// zimg converts between planar YUV formats of any depth from 8 to 16 bits, with proper chroma resampling
+	// and dithering when reducing the depth. It only converts whole images without scaling. Buffers that don't
+	// meet its alignment requirements are copied through staging buffers, allocated on first use.
+	class zimg_converter : public converter {
+		struct staging {
+			std::vector<uint8_t> buffer;
+			uint8_t*             data[4];
+			int                  linesize[4];
+		};
+
+		uint32_t           _width;
+		uint32_t           _height;
+		AVPixelFormat      _source_format;
+		AVPixelFormat      _target_format;
+		zimg_filter_graph* _graph;
+		std::vector<char>  _temp;
+		staging            _source;
+		staging            _target;
+
+		static void allocate(staging& s, AVPixelFormat format, uint32_t width, uint32_t height);
+
+		public:
+		zimg_converter(ffmpeg::swscale& config);
+		virtual ~zimg_converter();
+
+		virtual const char* get_name() override;
+
+		virtual int32_t convert(const uint8_t* const source_data[], const int source_stride[],
+		                        int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+		                        const int target_stride[]) override;
+	};
+} // namespace ffmpeg
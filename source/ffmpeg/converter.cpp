@@ -0,0 +1,219 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "converter.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include "plugin.hpp"
+#include "tools.hpp"
+#ifdef HAVE_LIBYUV
+#include "converter-libyuv.hpp"
+#endif
+#ifdef HAVE_ZIMG
+#include "converter-zimg.hpp"
+#endif
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+#pragma warning(pop)
+}
+
+#define ST_BACKEND_SWSCALE "swscale"
+#define ST_BACKEND_LIBYUV "libyuv"
+#define ST_BACKEND_ZIMG "zimg"
+
+// Rows of the strip that backends are measured on.
+#define ST_MEASURE_ROWS 64u
+
+std::vector<std::string> ffmpeg::converter::get_backends()
+{
+	std::vector<std::string> backends;
+	backends.push_back(ST_BACKEND_SWSCALE);
+#ifdef HAVE_LIBYUV
+	backends.push_back(ST_BACKEND_LIBYUV);
+#endif
+#ifdef HAVE_ZIMG
+	backends.push_back(ST_BACKEND_ZIMG);
+#endif
+	return backends;
+}
+
+std::shared_ptr<ffmpeg::converter> ffmpeg::converter::create(const std::string& backend, ffmpeg::swscale& config)
+{
+	try {
+		if (backend == ST_BACKEND_SWSCALE)
+			return std::make_shared<ffmpeg::swscale_converter>(config);
+#ifdef HAVE_LIBYUV
+		if (backend == ST_BACKEND_LIBYUV)
+			return std::make_shared<ffmpeg::libyuv_converter>(config);
+#endif
+#ifdef HAVE_ZIMG
+		if (backend == ST_BACKEND_ZIMG)
+			return std::make_shared<ffmpeg::zimg_converter>(config);
+#endif
+	} catch (const std::exception&) {
+		// The backend does not handle this conversion.
+	}
+	return nullptr;
+}
+
+std::string ffmpeg::converter::select(ffmpeg::swscale& config)
+{
+	static std::mutex                         lock;
+	static std::map<std::string, std::string> results;
+
+	std::stringstream key;
+	key << ffmpeg::tools::get_pixel_format_name(config.get_source_format()) << " "
+	    << ffmpeg::tools::get_color_space_name(config.get_source_colorspace()) << " "
+	    << (config.is_source_full_range() ? "full" : "partial") << " to "
+	    << ffmpeg::tools::get_pixel_format_name(config.get_target_format()) << " "
+	    << ffmpeg::tools::get_color_space_name(config.get_target_colorspace()) << " "
+	    << (config.is_target_full_range() ? "full" : "partial") << " at " << config.get_source_width() << "x"
+	    << config.get_source_height();
+
+	// Held during the measurement, so that encoders created together don't skew each other's results.
+	std::unique_lock<std::mutex> ul(lock);
+	auto                         kv = results.find(key.str());
+	if (kv != results.end())
+		return kv->second;
+
+	std::string best = ST_BACKEND_SWSCALE;
+	if (get_backends().size() == 1) {
+		results.emplace(key.str(), best);
+		return best;
+	}
+
+	// This runs while encoders are created and holds the lock, so only one strip of full width is measured,
+	// like the strip converter uses. Strips must start on a row that exists in every plane of both formats.
+	const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(config.get_source_format());
+	const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(config.get_target_format());
+	uint32_t                  align    = 1;
+	if (src_desc && dst_desc)
+		align = 1u << std::max(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+	uint32_t height = config.get_source_height();
+	uint32_t rows   = std::min(height, std::max((ST_MEASURE_ROWS + align - 1) / align * align, align));
+
+	ffmpeg::swscale strip;
+	strip.set_source_size(config.get_source_width(), rows);
+	strip.set_source_format(config.get_source_format());
+	strip.set_source_color(config.is_source_full_range(), config.get_source_colorspace());
+	strip.set_target_size(config.get_target_width(),
+	                      std::max(1u, rows * config.get_target_height() / std::max(1u, height)));
+	strip.set_target_format(config.get_target_format());
+	strip.set_target_color(config.is_target_full_range(), config.get_target_colorspace());
+
+	// Measure on noisy synthetic content, as some backends have shortcuts for flat content.
+	uint8_t* source[4]        = {0};
+	int      source_stride[4] = {0};
+	uint8_t* target[4]        = {0};
+	int      target_stride[4] = {0};
+	int source_size = av_image_alloc(source, source_stride, static_cast<int>(strip.get_source_width()),
+	                                 static_cast<int>(strip.get_source_height()), strip.get_source_format(), 64);
+	if (source_size < 0)
+		throw std::bad_alloc();
+	if (av_image_alloc(target, target_stride, static_cast<int>(strip.get_target_width()),
+	                   static_cast<int>(strip.get_target_height()), strip.get_target_format(), 64)
+	    < 0) {
+		av_freep(&source[0]);
+		throw std::bad_alloc();
+	}
+	uint32_t state = 0x4F424646;
+	for (int idx = 0; idx < source_size; idx++) {
+		state          = state * 1664525u + 1013904223u;
+		source[0][idx] = static_cast<uint8_t>(state >> 24);
+	}
+
+	double_t scale     = static_cast<double_t>(height) / rows;
+	double_t best_time = std::numeric_limits<double_t>::max();
+	for (auto& name : get_backends()) {
+		auto cv = create(name, strip);
+		if (!cv)
+			continue;
+
+		// The first run warms up caches and lazily allocated state, so only the fastest run counts.
+		double_t elapsed = std::numeric_limits<double_t>::max();
+		for (size_t run = 0; run < 5; run++) {
+			auto begin = std::chrono::high_resolution_clock::now();
+			if (cv->convert(source, source_stride, 0, static_cast<int32_t>(rows), target, target_stride)
+			    <= 0) {
+				elapsed = std::numeric_limits<double_t>::max();
+				break;
+			}
+			elapsed = std::min(elapsed, std::chrono::duration<double_t, std::milli>(
+			                                std::chrono::high_resolution_clock::now() - begin)
+			                                .count());
+		}
+		if (elapsed == std::numeric_limits<double_t>::max()) {
+			PLOG_WARNING("Converter '%s' failed to convert %s.", name.c_str(), key.str().c_str());
+			continue;
+		}
+
+		PLOG_INFO("Converter '%s' takes about %.3f ms for %s, measured on %u rows.", name.c_str(),
+		          elapsed * scale, key.str().c_str(), rows);
+		if (elapsed < best_time) {
+			best_time = elapsed;
+			best      = name;
+		}
+	}
+
+	av_freep(&source[0]);
+	av_freep(&target[0]);
+
+	results.emplace(key.str(), best);
+	return best;
+}
+
+ffmpeg::swscale_converter::swscale_converter(ffmpeg::swscale& config)
+{
+	_scaler.set_source_size(config.get_source_width(), config.get_source_height());
+	_scaler.set_source_format(config.get_source_format());
+	_scaler.set_source_color(config.is_source_full_range(), config.get_source_colorspace());
+	_scaler.set_target_size(config.get_target_width(), config.get_target_height());
+	_scaler.set_target_format(config.get_target_format());
+	_scaler.set_target_color(config.is_target_full_range(), config.get_target_colorspace());
+	if (!_scaler.initialize(SWS_POINT))
+		throw std::runtime_error("failed to initialize scaler");
+}
+
+ffmpeg::swscale_converter::~swscale_converter() {}
+
+const char* ffmpeg::swscale_converter::get_name()
+{
+	return ST_BACKEND_SWSCALE;
+}
+
+int32_t ffmpeg::swscale_converter::convert(const uint8_t* const source_data[], const int source_stride[],
+                                           int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+                                           const int target_stride[])
+{
+	return _scaler.convert(source_data, source_stride, source_row, source_rows, target_data, target_stride);
+}
@@ -0,0 +1,75 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "swscale.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/pixfmt.h>
+#pragma warning(pop)
+}
+
+namespace ffmpeg {
+	// Converts frames or slices of them between two pixel formats of the same size. The source and target
+	// are described by a configured swscale object, which is only used for its parameters.
+	class converter {
+		public:
+		virtual ~converter() {}
+
+		virtual const char* get_name() = 0;
+
+		// Same contract as swscale::convert, returns the number of rows written, or 0 or less on failure.
+		virtual int32_t convert(const uint8_t* const source_data[], const int source_stride[],
+		                        int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+		                        const int target_stride[]) = 0;
+
+		public:
+		// Names of all backends built into the plugin.
+		static std::vector<std::string> get_backends();
+
+		// Creates the named backend, or returns nullptr if it can't do this conversion.
+		static std::shared_ptr<converter> create(const std::string& backend, ffmpeg::swscale& config);
+
+		// Returns the fastest backend for this conversion. Every backend is measured once per format pair
+		// and size, later calls return the stored result.
+		static std::string select(ffmpeg::swscale& config);
+	};
+
+	class swscale_converter : public converter {
+		ffmpeg::swscale _scaler;
+
+		public:
+		swscale_converter(ffmpeg::swscale& config);
+		virtual ~swscale_converter();
+
+		virtual const char* get_name() override;
+
+		virtual int32_t convert(const uint8_t* const source_data[], const int source_stride[],
+		                        int32_t source_row, int32_t source_rows, uint8_t* const target_data[],
+		                        const int target_stride[]) override;
+	};
+} // namespace ffmpeg
@@ -0,0 +1,184 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "frame-parallel.hpp"
+#include <stdexcept>
+#include "tools.hpp"
+
+ffmpeg::frame_parallel::frame_parallel(const AVCodec* codec, const AVCodecContext* config, size_t count,
+                                       dispatcher_t dispatcher)
+    : _send(0), _receive(0), _dispatcher(dispatcher)
+{
+	if (count == 0)
+		throw std::invalid_argument("count must be at least 1");
+
+	_slots.resize(count);
+	for (auto& s : _slots) {
+		s.context = nullptr;
+		s.result  = 0;
+		s.state   = slot_state::IDLE;
+	}
+
+	try {
+		for (auto& s : _slots) {
+			s.context = avcodec_alloc_context3(codec);
+			if (!s.context)
+				throw std::bad_alloc();
+
+			AVCodecContext* ctx = s.context;
+			ffmpeg::tools::copy_codec_config(ctx, config);
+
+			// Each context encodes one frame at a time, the parallelism comes from having several.
+			ctx->thread_count = 1;
+			ctx->thread_type  = 0;
+
+			int res = avcodec_open2(ctx, codec, NULL);
+			if (res < 0)
+				throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+
+			s.packet =
+			    std::shared_ptr<AVPacket>(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+			if (!s.packet)
+				throw std::bad_alloc();
+		}
+	} catch (...) {
+		for (auto& s : _slots) {
+			if (s.context)
+				avcodec_free_context(&s.context);
+		}
+		throw;
+	}
+}
+
+ffmpeg::frame_parallel::~frame_parallel()
+{
+	wait();
+	for (auto& s : _slots) {
+		avcodec_close(s.context);
+		avcodec_free_context(&s.context);
+	}
+}
+
+bool ffmpeg::frame_parallel::is_supported(const AVCodec* codec)
+{
+	if (!codec || (codec->type != AVMEDIA_TYPE_VIDEO) || (codec->capabilities & AV_CODEC_CAP_DELAY))
+		return false;
+	if (codec->capabilities & AV_CODEC_CAP_INTRA_ONLY)
+		return true;
+	const AVCodecDescriptor* desc = avcodec_descriptor_get(codec->id);
+	return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+size_t ffmpeg::frame_parallel::get_count()
+{
+	return _slots.size();
+}
+
+bool ffmpeg::frame_parallel::is_full()
+{
+	std::unique_lock<std::mutex> ul(_lock);
+	return _slots[_send % _slots.size()].state != slot_state::IDLE;
+}
+
+void ffmpeg::frame_parallel::encode(slot& s)
+{
+	int res = avcodec_send_frame(s.context, s.frame.get());
+	if (res == 0)
+		res = avcodec_receive_packet(s.context, s.packet.get());
+	s.frame.reset();
+
+	std::unique_lock<std::mutex> ul(_lock);
+	s.result = res;
+	s.state  = slot_state::DONE;
+	_signal.notify_all();
+}
+
+int ffmpeg::frame_parallel::send_frame(const AVFrame* frame)
+{
+	if (!frame)
+		return AVERROR(EINVAL);
+
+	slot* s = nullptr;
+	{
+		std::unique_lock<std::mutex> ul(_lock);
+		s = &_slots[_send % _slots.size()];
+		if (s->state != slot_state::IDLE)
+			return AVERROR(EAGAIN);
+
+		// The caller may reuse its frame as soon as this returns, so the slot holds its own reference.
+		s->frame = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
+		if (!s->frame)
+			return AVERROR(ENOMEM);
+		int res = av_frame_ref(s->frame.get(), frame);
+		if (res < 0) {
+			s->frame.reset();
+			return res;
+		}
+
+		s->state = slot_state::BUSY;
+		_send++;
+	}
+
+	// A slot that never finishes would block receive_packet forever, so it is encoded here instead.
+	try {
+		_dispatcher([this, s]() { encode(*s); });
+	} catch (...) {
+		encode(*s);
+	}
+	return 0;
+}
+
+int ffmpeg::frame_parallel::receive_packet(AVPacket* packet, bool wait)
+{
+	std::unique_lock<std::mutex> ul(_lock);
+	while (true) {
+		slot& s = _slots[_receive % _slots.size()];
+		if (s.state == slot_state::IDLE)
+			return AVERROR(EAGAIN);
+		if (s.state == slot_state::BUSY) {
+			if (!wait)
+				return AVERROR(EAGAIN);
+			_signal.wait(ul, [&s]() { return s.state != slot_state::BUSY; });
+		}
+
+		int res = s.result;
+		if (res == 0)
+			av_packet_move_ref(packet, s.packet.get());
+		s.state = slot_state::IDLE;
+		_receive++;
+
+		// A frame the codec dropped has no packet, so the next one is up.
+		if (res != AVERROR(EAGAIN))
+			return res;
+	}
+}
+
+void ffmpeg::frame_parallel::wait()
+{
+	std::unique_lock<std::mutex> ul(_lock);
+	_signal.wait(ul, [this]() {
+		for (auto& s : _slots) {
+			if (s.state == slot_state::BUSY)
+				return false;
+		}
+		return true;
+	});
+}
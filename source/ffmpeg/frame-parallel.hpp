@@ -0,0 +1,91 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#pragma warning(pop)
+}
+
+namespace ffmpeg {
+	// Encodes consecutive frames on separate codec contexts at the same time, which only works for intra-only
+	// codecs where no frame depends on another. Packets come out in the order the frames went in, and at most
+	// one frame per context is in flight.
+	class frame_parallel {
+		public:
+		typedef std::function<void(std::function<void()> task)> dispatcher_t;
+
+		private:
+		enum class slot_state { IDLE, BUSY, DONE };
+
+		struct slot {
+			AVCodecContext*           context;
+			std::shared_ptr<AVFrame>  frame;
+			std::shared_ptr<AVPacket> packet;
+			int                       result;
+			slot_state                state;
+		};
+
+		std::vector<slot>       _slots;
+		size_t                  _send;
+		size_t                  _receive;
+		dispatcher_t            _dispatcher;
+		std::mutex              _lock;
+		std::condition_variable _signal;
+
+		void encode(slot& s);
+
+		public:
+		// Opens count copies of the configuration, which must be an opened context of the codec. Tasks given
+		// to the dispatcher must eventually run, on any thread.
+		frame_parallel(const AVCodec* codec, const AVCodecContext* config, size_t count,
+		               dispatcher_t dispatcher);
+		~frame_parallel();
+
+		// Intra-only codecs that return a packet for every frame right away.
+		static bool is_supported(const AVCodec* codec);
+
+		size_t get_count();
+
+		// True if the next frame can only be sent after the oldest one has been received.
+		bool is_full();
+
+		// Same results as avcodec_send_frame, AVERROR(EAGAIN) if every context is busy.
+		int send_frame(const AVFrame* frame);
+
+		// Same results as avcodec_receive_packet, AVERROR(EAGAIN) if nothing is in flight or, unless told to
+		// wait, the oldest frame is not done yet.
+		int receive_packet(AVPacket* packet, bool wait);
+
+		// Waits until every frame in flight is done.
+		void wait();
+	};
+} // namespace ffmpeg
@@ -0,0 +1,182 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "strip-converter.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "tools.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#pragma warning(pop)
+}
+
+static std::shared_ptr<AVFrame> make_frame()
+{
+	return std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* frame) {
+		av_frame_unref(frame);
+		av_frame_free(&frame);
+	});
+}
+
+ffmpeg::strip_converter::strip_converter(ffmpeg::swscale& config, const std::string& backend, uint32_t strip_height)
+    : _width(config.get_source_width()), _height(config.get_source_height()),
+      _source_format(config.get_source_format())
+{
+	// Strips must start on a row that exists in every plane of both formats.
+	const AVPixFmtDescriptor* src = av_pix_fmt_desc_get(config.get_source_format());
+	const AVPixFmtDescriptor* dst = av_pix_fmt_desc_get(config.get_target_format());
+	if (!src || !dst)
+		throw std::invalid_argument("unknown pixel format");
+	uint32_t align = 1u << std::max(src->log2_chroma_h, dst->log2_chroma_h);
+	strip_height   = std::max((strip_height + align - 1) / align * align, align);
+
+	for (uint32_t row = 0; row < _height; row += strip_height) {
+		strip s;
+		s.row   = row;
+		s.rows  = std::min(strip_height, _height - row);
+		s.hash  = 0;
+		s.valid = false;
+
+		ffmpeg::swscale strip_config;
+		strip_config.set_source_size(_width, s.rows);
+		strip_config.set_source_format(config.get_source_format());
+		strip_config.set_source_color(config.is_source_full_range(), config.get_source_colorspace());
+		strip_config.set_target_size(_width, s.rows);
+		strip_config.set_target_format(config.get_target_format());
+		strip_config.set_target_color(config.is_target_full_range(), config.get_target_colorspace());
+		s.converter = ffmpeg::converter::create(backend, strip_config);
+		if (!s.converter)
+			s.converter = ffmpeg::converter::create("swscale", strip_config);
+		if (!s.converter)
+			throw std::runtime_error("failed to initialize strip converter");
+		_strips.push_back(s);
+	}
+
+	_target         = make_frame();
+	_target->width  = static_cast<int>(_width);
+	_target->height = static_cast<int>(_height);
+	_target->format = config.get_target_format();
+	int res         = av_frame_get_buffer(_target.get(), 32);
+	if (res < 0)
+		throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+}
+
+ffmpeg::strip_converter::~strip_converter() {}
+
+uint64_t ffmpeg::strip_converter::hash(const uint8_t* const data[], const int linesize[], strip& s)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(_source_format);
+
+	// Four independent lanes, so that the multiplications don't wait on each other.
+	uint64_t lanes[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+	                     0x27D4EB2F165667C5ull};
+	for (int plane = 0; plane < av_pix_fmt_count_planes(_source_format); plane++) {
+		uint32_t shift = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+		uint32_t row   = s.row >> shift;
+		uint32_t rows  = (s.rows + (1u << shift) - 1) >> shift;
+		size_t   bytes =
+		    static_cast<size_t>(av_image_get_linesize(_source_format, static_cast<int>(_width), plane));
+
+		for (uint32_t y = row; y < row + rows; y++) {
+			const uint8_t* ptr = data[plane] + static_cast<ptrdiff_t>(y) * linesize[plane];
+			size_t         idx = 0;
+			for (; idx + 32 <= bytes; idx += 32) {
+				for (size_t lane = 0; lane < 4; lane++) {
+					uint64_t v;
+					std::memcpy(&v, ptr + idx + lane * 8, sizeof(v));
+					lanes[lane] = (lanes[lane] ^ v) * 0x100000001B3ull;
+					lanes[lane] ^= lanes[lane] >> 31;
+				}
+			}
+			for (; idx < bytes; idx++) {
+				lanes[0] = (lanes[0] ^ ptr[idx]) * 0x100000001B3ull;
+			}
+		}
+	}
+
+	return lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+}
+
+size_t ffmpeg::strip_converter::convert(const uint8_t* const data[], const int linesize[], executor_t executor)
+{
+	// Someone (usually the codec) still reads the previous target, so continue on a copy of it.
+	if (!av_frame_is_writable(_target.get())) {
+		int res = av_frame_make_writable(_target.get());
+		if (res < 0)
+			throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+	}
+
+	const AVPixFmtDescriptor* src = av_pix_fmt_desc_get(_source_format);
+	const AVPixFmtDescriptor* dst = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(_target->format));
+
+	std::vector<uint8_t> changed(_strips.size(), 0);
+	executor(_strips.size(), [&](size_t job, size_t) {
+		strip&   s    = _strips[job];
+		uint64_t hash = this->hash(data, linesize, s);
+		if (s.valid && (s.hash == hash))
+			return;
+
+		const uint8_t* source[AV_NUM_DATA_POINTERS] = {0};
+		uint8_t*       target[AV_NUM_DATA_POINTERS] = {0};
+		for (size_t plane = 0; plane < AV_NUM_DATA_POINTERS; plane++) {
+			uint32_t src_shift = (plane == 1 || plane == 2) ? src->log2_chroma_h : 0;
+			uint32_t dst_shift = (plane == 1 || plane == 2) ? dst->log2_chroma_h : 0;
+			if (data[plane])
+				source[plane] =
+				    data[plane] + static_cast<ptrdiff_t>(s.row >> src_shift) * linesize[plane];
+			if (_target->data[plane])
+				target[plane] = _target->data[plane]
+				                + static_cast<ptrdiff_t>(s.row >> dst_shift) * _target->linesize[plane];
+		}
+
+		if (s.converter->convert(source, linesize, 0, static_cast<int32_t>(s.rows), target, _target->linesize)
+		    <= 0) {
+			s.valid = false;
+			return;
+		}
+		s.hash       = hash;
+		s.valid      = true;
+		changed[job] = 1;
+	});
+
+	size_t count = 0;
+	for (auto v : changed)
+		count += v;
+	return count;
+}
+
+std::shared_ptr<AVFrame> ffmpeg::strip_converter::get_frame()
+{
+	std::shared_ptr<AVFrame> frame = make_frame();
+	if (av_frame_ref(frame.get(), _target.get()) < 0)
+		throw std::runtime_error("failed to reference target frame");
+	return frame;
+}
+
+size_t ffmpeg::strip_converter::get_strip_count()
+{
+	return _strips.size();
+}
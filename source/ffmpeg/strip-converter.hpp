@@ -0,0 +1,77 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "converter.hpp"
+#include "swscale.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#pragma warning(pop)
+}
+
+namespace ffmpeg {
+	// Converts frames into a persistent target frame in horizontal strips, and skips any strip whose
+	// source is unchanged since the previous frame. Each strip has its own converter, so strips can be
+	// converted in any order and in parallel.
+	class strip_converter {
+		struct strip {
+			uint32_t                           row;
+			uint32_t                           rows;
+			uint64_t                           hash;
+			bool                               valid;
+			std::shared_ptr<ffmpeg::converter> converter;
+		};
+
+		uint32_t                 _width;
+		uint32_t                 _height;
+		AVPixelFormat            _source_format;
+		std::vector<strip>       _strips;
+		std::shared_ptr<AVFrame> _target;
+
+		uint64_t hash(const uint8_t* const data[], const int linesize[], strip& s);
+
+		public:
+		// Strips use the given conversion backend, or swscale if the backend can't convert a strip.
+		strip_converter(ffmpeg::swscale& config, const std::string& backend, uint32_t strip_height = 64);
+		~strip_converter();
+
+		typedef std::function<void(size_t count, std::function<void(size_t job, size_t thread)> job)>
+		    executor_t;
+
+		// Updates the target frame from the given source, and returns the number of strips that changed.
+		size_t convert(const uint8_t* const data[], const int linesize[], executor_t executor);
+
+		// Returns a new reference to the target frame. The target is copied before the next conversion
+		// if any reference is still alive by then.
+		std::shared_ptr<AVFrame> get_frame();
+
+		size_t get_strip_count();
+	};
+} // namespace ffmpeg
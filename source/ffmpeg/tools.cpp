@@ -20,8 +20,10 @@
 // SOFTWARE.
 
 #include "tools.hpp"
+#include <cstring>
 #include <list>
 #include <map>
+#include <new>
 #include <sstream>
 #include <stdexcept>
 #include "plugin.hpp"
@@ -140,6 +142,10 @@ static std::map<video_format, AVPixelFormat> obs_to_av_format_map = {
     {VIDEO_FORMAT_I42A, AV_PIX_FMT_YUVA422P}, //
     {VIDEO_FORMAT_YUVA, AV_PIX_FMT_YUVA444P}, //
                                               //{VIDEO_FORMAT_AYUV, AV_PIX_FMT_AYUV444P}, //
+#if LIBOBS_API_MAJOR_VER >= 28
+    {VIDEO_FORMAT_I010, AV_PIX_FMT_YUV420P10LE}, // 10-bit YUV 4:2:0
+    {VIDEO_FORMAT_P010, AV_PIX_FMT_P010LE},      // 10-bit NV12, samples in the upper bits
+#endif
 };
 
 AVPixelFormat ffmpeg::tools::obs_videoformat_to_avpixelformat(video_format v)
@@ -166,6 +172,113 @@ AVPixelFormat ffmpeg::tools::get_least_lossy_format(const AVPixelFormat* haystac
 	return avcodec_find_best_pix_fmt_of_list(haystack, needle, 0, &data_loss);
 }
 
+double_t ffmpeg::tools::get_conversion_cost(AVPixelFormat source, AVPixelFormat target)
+{
+	if (source == target)
+		return 0.0;
+
+	const AVPixFmtDescriptor* src = av_pix_fmt_desc_get(source);
+	const AVPixFmtDescriptor* dst = av_pix_fmt_desc_get(target);
+	if (!src || !dst)
+		return HUGE_VAL;
+
+	// Every conversion has to read the source and write the target once.
+	double_t cost = (av_get_padded_bits_per_pixel(src) + av_get_padded_bits_per_pixel(dst)) / 8.0;
+
+	bool src_rgb = (src->flags & AV_PIX_FMT_FLAG_RGB) != 0;
+	bool dst_rgb = (dst->flags & AV_PIX_FMT_FLAG_RGB) != 0;
+	if (src_rgb != dst_rgb) {
+		// Color matrix applied to every pixel, plus chroma resampling when going to or from subsampled YUV.
+		cost *= 4.0;
+		if ((src->log2_chroma_w + src->log2_chroma_h + dst->log2_chroma_w + dst->log2_chroma_h) != 0)
+			cost *= 1.5;
+	} else if ((src->log2_chroma_w != dst->log2_chroma_w) || (src->log2_chroma_h != dst->log2_chroma_h)) {
+		// Chroma has to be resampled.
+		cost *= 2.0;
+	} else if (src->comp[0].depth != dst->comp[0].depth) {
+		// Every sample has to be shifted.
+		cost *= 1.5;
+	}
+	// Anything else only moves samples around, like NV12 to YUV420P, for which swscale has fast paths.
+
+	return cost;
+}
+
+std::string ffmpeg::tools::get_loss_description(int loss)
+{
+	std::pair<int, const char*> flags[] = {
+	    {FF_LOSS_RESOLUTION, "resolution"}, {FF_LOSS_DEPTH, "depth"},   {FF_LOSS_COLORSPACE, "color space"},
+	    {FF_LOSS_ALPHA, "alpha"},           {FF_LOSS_COLORQUANT, "quantization"}, {FF_LOSS_CHROMA, "chroma"},
+	};
+
+	if (loss == 0)
+		return "none";
+
+	std::stringstream sstr;
+	for (auto const kv : flags) {
+		if (loss & kv.first) {
+			if (sstr.tellp() > 0)
+				sstr << ", ";
+			sstr << kv.second;
+		}
+	}
+	return sstr.str();
+}
+
+static int count_flags(int flags)
+{
+	int count = 0;
+	for (; flags != 0; flags &= flags - 1)
+		count++;
+	return count;
+}
+
+ffmpeg::tools::format_choice ffmpeg::tools::get_best_format(const AVPixelFormat* haystack, AVPixelFormat needle,
+                                                            int loss_tolerance)
+{
+	format_choice least_lossy;
+	least_lossy.format = get_least_lossy_format(haystack, needle);
+	if (least_lossy.format == AV_PIX_FMT_NONE)
+		return least_lossy;
+
+	const AVPixFmtDescriptor* needle_desc = av_pix_fmt_desc_get(needle);
+	int                       has_alpha   = (needle_desc && (needle_desc->flags & AV_PIX_FMT_FLAG_ALPHA)) ? 1 : 0;
+
+	least_lossy.loss   = av_get_pix_fmt_loss(least_lossy.format, needle, has_alpha);
+	least_lossy.cost   = get_conversion_cost(needle, least_lossy.format);
+	least_lossy.reason = "least lossy format";
+
+	format_choice best = least_lossy;
+	int           allowed_loss = least_lossy.loss | loss_tolerance;
+	for (auto fmt = haystack; fmt && (*fmt != AV_PIX_FMT_NONE); fmt++) {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*fmt);
+		if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+			continue;
+
+		int loss = av_get_pix_fmt_loss(*fmt, needle, has_alpha);
+		if ((loss & ~allowed_loss) != 0)
+			continue;
+
+		double_t cost = get_conversion_cost(needle, *fmt);
+		if ((cost < best.cost) || ((cost == best.cost) && (count_flags(loss) < count_flags(best.loss)))) {
+			best.format = *fmt;
+			best.loss   = loss;
+			best.cost   = cost;
+		}
+	}
+
+	if (best.format == least_lossy.format) {
+		best.reason = (best.cost == 0.0) ? "no conversion needed" : "least lossy format";
+	} else {
+		std::stringstream sstr;
+		sstr << (best.cost == 0.0 ? "no conversion needed" : "cheaper conversion") << ", instead of '"
+		     << get_pixel_format_name(least_lossy.format) << "' (cost " << least_lossy.cost << ")";
+		best.reason = sstr.str();
+	}
+
+	return best;
+}
+
 AVColorSpace ffmpeg::tools::obs_videocolorspace_to_avcolorspace(video_colorspace v)
 {
 	switch (v) {
@@ -174,6 +287,13 @@ AVColorSpace ffmpeg::tools::obs_videocolorspace_to_avcolorspace(video_colorspace
 		return AVCOL_SPC_BT709;
 	case VIDEO_CS_601:
 		return AVCOL_SPC_BT470BG;
+#if LIBOBS_API_MAJOR_VER >= 28
+	case VIDEO_CS_SRGB:
+		return AVCOL_SPC_BT709;
+	case VIDEO_CS_2100_PQ:
+	case VIDEO_CS_2100_HLG:
+		return AVCOL_SPC_BT2020_NCL;
+#endif
 	}
 	throw std::invalid_argument("unknown color space");
 }
@@ -241,6 +361,21 @@ std::vector<AVPixelFormat> ffmpeg::tools::get_software_formats(const AVPixelForm
 	return std::move(fmts);
 }
 
+std::vector<const AVCodec*> ffmpeg::tools::get_encoders(AVCodecID id)
+{
+	std::vector<const AVCodec*> encoders;
+#if LIBAVCODEC_VERSION_MAJOR >= 58
+	void* storage = nullptr;
+	for (const AVCodec* cdc = av_codec_iterate(&storage); cdc != nullptr; cdc = av_codec_iterate(&storage)) {
+#else
+	for (const AVCodec* cdc = av_codec_next(nullptr); cdc != nullptr; cdc = av_codec_next(cdc)) {
+#endif
+		if (av_codec_is_encoder(cdc) && (cdc->id == id))
+			encoders.push_back(cdc);
+	}
+	return encoders;
+}
+
 void ffmpeg::tools::setup_obs_color(video_colorspace colorspace, video_range_type range, AVCodecContext* context)
 {
 	std::map<video_colorspace, std::tuple<AVColorSpace, AVColorPrimaries, AVColorTransferCharacteristic>>
@@ -248,6 +383,11 @@ void ffmpeg::tools::setup_obs_color(video_colorspace colorspace, video_range_typ
 	        {VIDEO_CS_DEFAULT, {AVCOL_SPC_BT470BG, AVCOL_PRI_BT470BG, AVCOL_TRC_SMPTE170M}},
 	        {VIDEO_CS_601, {AVCOL_SPC_BT470BG, AVCOL_PRI_BT470BG, AVCOL_TRC_SMPTE170M}},
 	        {VIDEO_CS_709, {AVCOL_SPC_BT709, AVCOL_PRI_BT709, AVCOL_TRC_BT709}},
+#if LIBOBS_API_MAJOR_VER >= 28
+	        {VIDEO_CS_SRGB, {AVCOL_SPC_BT709, AVCOL_PRI_BT709, AVCOL_TRC_IEC61966_2_1}},
+	        {VIDEO_CS_2100_PQ, {AVCOL_SPC_BT2020_NCL, AVCOL_PRI_BT2020, AVCOL_TRC_SMPTE2084}},
+	        {VIDEO_CS_2100_HLG, {AVCOL_SPC_BT2020_NCL, AVCOL_PRI_BT2020, AVCOL_TRC_ARIB_STD_B67}},
+#endif
 	    };
 	std::map<video_range_type, AVColorRange> colorranges = {
 	    {VIDEO_RANGE_DEFAULT, AVCOL_RANGE_MPEG},
@@ -274,6 +414,155 @@ void ffmpeg::tools::setup_obs_color(video_colorspace colorspace, video_range_typ
 	context->chroma_sample_location = AVCHROMA_LOC_CENTER;
 }
 
+void ffmpeg::tools::copy_codec_config(AVCodecContext* target, const AVCodecContext* source)
+{
+	if (av_opt_copy(target, source) < 0)
+		throw std::runtime_error("Failed to copy codec options.");
+	if (target->priv_data && source->priv_data && (av_opt_copy(target->priv_data, source->priv_data) < 0))
+		throw std::runtime_error("Failed to copy private codec options.");
+
+	// Anything the encoder sets directly.
+	target->width                  = source->width;
+	target->height                 = source->height;
+	target->pix_fmt                = source->pix_fmt;
+	target->time_base              = source->time_base;
+	target->framerate              = source->framerate;
+	target->sample_aspect_ratio    = source->sample_aspect_ratio;
+	target->field_order            = source->field_order;
+	target->color_range            = source->color_range;
+	target->colorspace             = source->colorspace;
+	target->color_primaries        = source->color_primaries;
+	target->color_trc              = source->color_trc;
+	target->chroma_sample_location = source->chroma_sample_location;
+}
+
+// Presets of libx264 and libx265, from the fastest to the slowest.
+static const char* x26x_presets[] = {"ultrafast", "superfast", "veryfast", "faster", "fast",
+                                     "medium",    "slow",      "slower",   "veryslow", "placebo"};
+
+// Finds the preset after the current one, by name for libx264 and libx265 or as cpu-used otherwise.
+static bool find_faster_preset(AVCodecContext* context, std::string& name, int64_t& cpu_used)
+{
+	const AVOption* opt = av_opt_find(context, "preset", nullptr, 0, AV_OPT_SEARCH_CHILDREN);
+	if (opt && (opt->type == AV_OPT_TYPE_STRING)) {
+		uint8_t* value = nullptr;
+		if (av_opt_get(context, "preset", AV_OPT_SEARCH_CHILDREN, &value) < 0)
+			return false;
+		// Both encoders treat no preset as medium.
+		std::string preset = (value && (value[0] != '\0')) ? reinterpret_cast<char*>(value) : "medium";
+		av_free(value);
+
+		for (size_t idx = 1; idx < sizeof(x26x_presets) / sizeof(x26x_presets[0]); idx++) {
+			if (preset != x26x_presets[idx])
+				continue;
+			name = x26x_presets[idx - 1];
+			return true;
+		}
+		return false;
+	}
+
+	// Larger values are faster, and negative ones are only used by libvpx for the same thing in reverse.
+	opt = av_opt_find(context, "cpu-used", nullptr, 0, AV_OPT_SEARCH_CHILDREN);
+	int64_t current = 0;
+	if (!opt || (av_opt_get_int(context, "cpu-used", AV_OPT_SEARCH_CHILDREN, &current) < 0))
+		return false;
+	cpu_used = (current < 0) ? (current - 1) : (current + 1);
+	return (cpu_used <= opt->max) && (cpu_used >= opt->min);
+}
+
+bool ffmpeg::tools::has_faster_preset(AVCodecContext* context)
+{
+	std::string name;
+	int64_t     cpu_used = 0;
+	return find_faster_preset(context, name, cpu_used);
+}
+
+bool ffmpeg::tools::set_faster_preset(AVCodecContext* context)
+{
+	std::string name;
+	int64_t     cpu_used = 0;
+	if (!find_faster_preset(context, name, cpu_used))
+		return false;
+	if (!name.empty())
+		return av_opt_set(context, "preset", name.c_str(), AV_OPT_SEARCH_CHILDREN) >= 0;
+	return av_opt_set_int(context, "cpu-used", cpu_used, AV_OPT_SEARCH_CHILDREN) >= 0;
+}
+
+bool ffmpeg::tools::get_obs_hdr_metadata(video_colorspace colorspace, hdr_metadata& metadata)
+{
+	metadata = hdr_metadata();
+
+#if LIBOBS_API_MAJOR_VER >= 28
+	// HLG is relative to the display, so the reference peak of 1000 nits is used like OBS Studio does.
+	int peak = 0;
+	if (colorspace == VIDEO_CS_2100_PQ) {
+		peak = static_cast<int>(obs_get_video_hdr_nominal_peak_level());
+	} else if (colorspace == VIDEO_CS_2100_HLG) {
+		peak = 1000;
+	} else {
+		return false;
+	}
+
+	// Mastering display with P3-D65 primaries, like the one OBS Studio describes.
+	auto& mastering                   = metadata.mastering;
+	mastering.display_primaries[0][0] = av_make_q(17, 25);
+	mastering.display_primaries[0][1] = av_make_q(8, 25);
+	mastering.display_primaries[1][0] = av_make_q(53, 200);
+	mastering.display_primaries[1][1] = av_make_q(69, 100);
+	mastering.display_primaries[2][0] = av_make_q(3, 20);
+	mastering.display_primaries[2][1] = av_make_q(3, 50);
+	mastering.white_point[0]          = av_make_q(3127, 10000);
+	mastering.white_point[1]          = av_make_q(329, 1000);
+	mastering.min_luminance           = av_make_q(0, 1);
+	mastering.max_luminance           = av_make_q(peak, 1);
+	mastering.has_primaries           = 1;
+	mastering.has_luminance           = 1;
+
+	metadata.light.MaxCLL  = static_cast<unsigned>(peak);
+	metadata.light.MaxFALL = static_cast<unsigned>(peak);
+	return true;
+#else
+	(void)colorspace;
+	return false;
+#endif
+}
+
+void ffmpeg::tools::attach_hdr_metadata(AVFrame* frame, const hdr_metadata& metadata)
+{
+	// Frames are recycled, so side data from the last use has to go first.
+	av_frame_remove_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+	av_frame_remove_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+
+	AVMasteringDisplayMetadata* mastering = av_mastering_display_metadata_create_side_data(frame);
+	AVContentLightMetadata*     light     = av_content_light_metadata_create_side_data(frame);
+	if (!mastering || !light)
+		throw std::bad_alloc();
+	*mastering = metadata.mastering;
+	*light     = metadata.light;
+}
+
+void ffmpeg::tools::setup_hdr_metadata(AVCodecContext* context, const hdr_metadata& metadata)
+{
+#if LIBAVCODEC_VERSION_MAJOR >= 61
+	av_frame_side_data_free(&context->decoded_side_data, &context->nb_decoded_side_data);
+
+	AVFrameSideData* mastering =
+	    av_frame_side_data_new(&context->decoded_side_data, &context->nb_decoded_side_data,
+	                           AV_FRAME_DATA_MASTERING_DISPLAY_METADATA, sizeof(AVMasteringDisplayMetadata), 0);
+	AVFrameSideData* light =
+	    av_frame_side_data_new(&context->decoded_side_data, &context->nb_decoded_side_data,
+	                           AV_FRAME_DATA_CONTENT_LIGHT_LEVEL, sizeof(AVContentLightMetadata), 0);
+	if (!mastering || !light)
+		throw std::bad_alloc();
+	std::memcpy(mastering->data, &metadata.mastering, sizeof(AVMasteringDisplayMetadata));
+	std::memcpy(light->data, &metadata.light, sizeof(AVContentLightMetadata));
+#else
+	// Older versions only take the metadata from frames.
+	(void)context;
+	(void)metadata;
+#endif
+}
+
 const char* ffmpeg::tools::get_std_compliance_name(int compliance)
 {
 	switch (compliance) {
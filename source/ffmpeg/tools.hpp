@@ -23,6 +23,7 @@
 #define OBS_FFMPEG_FFMPEG_UTILITY
 #pragma once
 
+#include <cmath>
 #include <functional>
 #include <obs.h>
 #include <string>
@@ -30,6 +31,7 @@
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavutil/mastering_display_metadata.h>
 #include <libavutil/pixfmt.h>
 }
 
@@ -49,6 +51,21 @@ namespace ffmpeg {
 
 		AVPixelFormat get_least_lossy_format(const AVPixelFormat* haystack, AVPixelFormat needle);
 
+		struct format_choice {
+			AVPixelFormat format = AV_PIX_FMT_NONE;
+			int           loss   = 0;   // FF_LOSS_* flags of converting to this format.
+			double_t      cost   = 0.0; // Modelled conversion cost, relative to copying one byte per pixel.
+			std::string   reason;
+		};
+
+		double_t get_conversion_cost(AVPixelFormat source, AVPixelFormat target);
+
+		std::string get_loss_description(int loss);
+
+		// Picks the cheapest format to convert to among those that lose no more than the least lossy
+		// format plus the FF_LOSS_* flags in loss_tolerance.
+		format_choice get_best_format(const AVPixelFormat* haystack, AVPixelFormat needle, int loss_tolerance);
+
 		AVColorSpace obs_videocolorspace_to_avcolorspace(video_colorspace v);
 
 		AVColorRange obs_videorangetype_to_avcolorrange(video_range_type v);
@@ -57,8 +74,39 @@ namespace ffmpeg {
 
 		std::vector<AVPixelFormat> get_software_formats(const AVPixelFormat* list);
 
+		// All encoders for the given codec, in the order libavcodec lists them.
+		std::vector<const AVCodec*> get_encoders(AVCodecID id);
+
 		void setup_obs_color(video_colorspace colorspace, video_range_type range, AVCodecContext* context);
 
+		// Copies the configuration of one context into another that is not opened yet, for running the same
+		// encoder more than once. Options cover most of it, including the codec's private ones.
+		void copy_codec_config(AVCodecContext* target, const AVCodecContext* source);
+
+		// Whether the encoder has a faster preset than the one it is set to, among presets that trade quality
+		// for speed in a known order, which are the named presets of libx264 and libx265, and cpu-used of libvpx
+		// and libaom.
+		bool has_faster_preset(AVCodecContext* context);
+
+		// Switches an encoder that is not opened yet to the next faster preset. Returns false if it already
+		// uses the fastest one.
+		bool set_faster_preset(AVCodecContext* context);
+
+		struct hdr_metadata {
+			AVMasteringDisplayMetadata mastering = {};
+			AVContentLightMetadata     light     = {};
+		};
+
+		// Fills in the mastering display and content light level OBS Studio itself writes for HDR output.
+		// Returns false for SDR color spaces, which have neither.
+		bool get_obs_hdr_metadata(video_colorspace colorspace, hdr_metadata& metadata);
+
+		// Replaces any mastering display and content light level side data on the frame.
+		void attach_hdr_metadata(AVFrame* frame, const hdr_metadata& metadata);
+
+		// Hands the metadata to encoders that write it into their headers, where libavcodec supports it.
+		void setup_hdr_metadata(AVCodecContext* context, const hdr_metadata& metadata);
+
 		const char* get_std_compliance_name(int compliance);
 
 		const char* get_thread_type_name(int thread_type);
@@ -0,0 +1,167 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "frame-tap.hpp"
+#include <stdexcept>
+#include "plugin.hpp"
+#include "trace.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/imgutils.h>
+#pragma warning(pop)
+}
+
+using namespace obsffmpeg::ipc::frame_tap_layout;
+
+static size_t align(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+obsffmpeg::ipc::frame_tap::frame_tap(std::string name, AVPixelFormat format, int width, int height,
+                                     uint32_t slot_count)
+    : _header(nullptr), _slots(nullptr), _pictures(nullptr), _format(format), _width(width), _height(height),
+      _interval(0), _counter(0), _sequence(0), _requests(0), _published(0), _dropped(0)
+{
+	// One slot is always kept as the latest frame, so at least two are needed to publish anything new.
+	if ((slot_count < 2) || (slot_count > max_slots))
+		throw std::invalid_argument("slot count must be between 2 and 255");
+
+	int picture_size = av_image_get_buffer_size(format, width, height, 32);
+	if (picture_size <= 0)
+		throw std::invalid_argument("unsupported frame format");
+
+	size_t offset_slots = align(sizeof(header), 64);
+	size_t offset_data  = align(offset_slots + sizeof(slot) * slot_count, 4096);
+	size_t slot_size    = align(static_cast<size_t>(picture_size), 4096);
+	_memory             = std::make_unique<shared_memory>(name, offset_data + slot_size * slot_count);
+
+	// The memory is zero filled, so every atomic already holds zero.
+	_header   = reinterpret_cast<header*>(_memory->data());
+	_slots    = reinterpret_cast<slot*>(_memory->data() + offset_slots);
+	_pictures = _memory->data() + offset_data;
+
+	uint8_t* planes[max_planes] = {nullptr};
+	int      linesize[max_planes] = {0};
+	if (av_image_fill_arrays(planes, linesize, _pictures, format, width, height, 32) < 0)
+		throw std::invalid_argument("unsupported frame format");
+	for (size_t idx = 0; idx < max_planes; idx++) {
+		_header->linesize[idx]     = linesize[idx];
+		_header->plane_offset[idx] = planes[idx] ? static_cast<uint64_t>(planes[idx] - _pictures) : 0;
+	}
+
+	_header->slot_count  = slot_count;
+	_header->format      = static_cast<int32_t>(format);
+	_header->width       = static_cast<uint32_t>(width);
+	_header->height      = static_cast<uint32_t>(height);
+	_header->slot_offset = offset_data;
+	_header->slot_size   = slot_size;
+	_header->version     = version;
+	std::atomic_thread_fence(std::memory_order_release);
+	_header->magic = magic;
+}
+
+obsffmpeg::ipc::frame_tap::~frame_tap()
+{
+	PLOG_INFO("<frame tap '%s'> Published %llu frames, %llu were skipped as no slot was free.",
+	          _memory->get_name().c_str(), static_cast<unsigned long long>(_published),
+	          static_cast<unsigned long long>(_dropped));
+
+	// Wake up sleeping readers so that they notice the tap is gone.
+	_header->magic = 0;
+	shared_memory::wake(_header->futex, _header->waiters);
+}
+
+void obsffmpeg::ipc::frame_tap::set_interval(uint32_t interval)
+{
+	_interval = interval;
+}
+
+bool obsffmpeg::ipc::frame_tap::matches(std::string name, AVPixelFormat format, int width, int height)
+{
+	return (_memory->get_name() == name) && (_format == format) && (_width == width) && (_height == height);
+}
+
+void obsffmpeg::ipc::frame_tap::push(const AVFrame* frame)
+{
+	if ((frame->format != _format) || (frame->width != _width) || (frame->height != _height))
+		return;
+
+	bool     due      = (_interval > 0) && ((_counter++ % _interval) == 0);
+	uint32_t requests = _header->requests.load(std::memory_order_acquire);
+	if (!due && (requests == _requests))
+		return;
+
+	// Claim a slot that nobody reads, without ever touching the latest one.
+	uint32_t latest = static_cast<uint32_t>(_header->latest.load(std::memory_order_relaxed) & 0xFF);
+	slot*    target = nullptr;
+	uint32_t index  = 0;
+	for (uint32_t idx = 0; idx < _header->slot_count; idx++) {
+		if ((_sequence > 0) && (idx == latest))
+			continue;
+
+		int32_t expected = 0;
+		if (_slots[idx].references.compare_exchange_strong(expected, -1, std::memory_order_acquire)) {
+			target = &_slots[idx];
+			index  = idx;
+			break;
+		}
+	}
+	if (!target) {
+		TRACE_PROBE3(drop, this, frame->pts, static_cast<int>(obsffmpeg::trace_drop::FRAME_TAP));
+		_dropped++;
+		return;
+	}
+
+	uint8_t* picture = _pictures + _header->slot_size * index;
+	uint8_t* planes[max_planes];
+	int      linesize[max_planes];
+	for (size_t idx = 0; idx < max_planes; idx++) {
+		planes[idx]   = picture + _header->plane_offset[idx];
+		linesize[idx] = _header->linesize[idx];
+	}
+	av_image_copy(planes, linesize, const_cast<const uint8_t**>(frame->data), frame->linesize, _format, _width,
+	              _height);
+
+	_sequence++;
+	target->pts         = frame->pts;
+	target->color_range = static_cast<int32_t>(frame->color_range);
+	target->colorspace  = static_cast<int32_t>(frame->colorspace);
+	target->sequence.store(_sequence, std::memory_order_relaxed);
+	target->references.store(0, std::memory_order_release);
+	_header->latest.store((_sequence << 8) | index, std::memory_order_release);
+	shared_memory::wake(_header->futex, _header->waiters);
+
+	_requests = requests;
+	_published++;
+}
+
+const std::string& obsffmpeg::ipc::frame_tap::get_announce_path()
+{
+	return _memory->get_announce_path();
+}
+
+bool obsffmpeg::ipc::frame_tap::is_supported()
+{
+	return shared_memory::is_supported();
+}
@@ -0,0 +1,126 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "shared-memory.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#pragma warning(pop)
+}
+
+namespace obsffmpeg {
+	namespace ipc {
+		// Memory layout of a frame tap. The memory starts with a header, followed by the slot headers and
+		// then the picture of every slot. Readers find the memory as described for shared_memory.
+		//
+		// Reading the latest frame:
+		// 1. Load header.latest, the upper bits hold the frame sequence and the lowest 8 bits the slot.
+		//    Readers that want a frame right away increment header.requests first, and may sleep with
+		//    FUTEX_WAIT on header.futex while holding header.waiters raised.
+		// 2. Acquire the slot by incrementing its references with a compare and swap, which is only
+		//    allowed while the value is not negative. A negative value means the encoder is writing.
+		// 3. If the slot sequence no longer matches, release it and start over.
+		// 4. Read the planes at plane_offset with the given linesize, then decrement references.
+		// Slots stay untouched for as long as they are referenced, a reader that holds on to slots for
+		// too long makes the encoder skip frames for the tap, but never delays encoding.
+		namespace frame_tap_layout {
+			constexpr uint32_t magic   = 0x5446464F; // "OFFT"
+			constexpr uint32_t version = 1;
+
+			constexpr size_t max_planes = 4;
+			constexpr size_t max_slots  = 255;
+
+			struct header {
+				uint32_t magic;
+				uint32_t version;
+				uint32_t slot_count;
+				int32_t  format; // AVPixelFormat
+				uint32_t width;
+				uint32_t height;
+				int32_t  linesize[max_planes];
+				uint64_t plane_offset[max_planes]; // Relative to the picture of a slot.
+				uint64_t slot_offset;              // Picture of the first slot.
+				uint64_t slot_size;
+
+				std::atomic<uint32_t> futex; // Changes whenever a frame is published.
+				std::atomic<uint32_t> waiters;
+				std::atomic<uint64_t> latest;
+				std::atomic<uint32_t> requests;
+				uint32_t              reserved;
+			};
+
+			struct slot {
+				std::atomic<int32_t>  references;
+				uint32_t              reserved;
+				std::atomic<uint64_t> sequence;
+				int64_t               pts;
+				int32_t               color_range; // AVColorRange
+				int32_t               colorspace;  // AVColorSpace
+			};
+		} // namespace frame_tap_layout
+
+		// Publishes converted frames into a pool of shared memory slots, either every Nth frame or when a
+		// reader asks for one. The encoder only pays for finding a free slot and one copy, and if no slot
+		// is free the frame is not published.
+		class frame_tap {
+			std::unique_ptr<shared_memory> _memory;
+			frame_tap_layout::header*      _header;
+			frame_tap_layout::slot*        _slots;
+			uint8_t*                       _pictures;
+
+			AVPixelFormat _format;
+			int           _width;
+			int           _height;
+
+			uint32_t _interval;
+			uint64_t _counter;
+			uint64_t _sequence;
+			uint32_t _requests;
+			uint64_t _published;
+			uint64_t _dropped;
+
+			public:
+			frame_tap(std::string name, AVPixelFormat format, int width, int height,
+			          uint32_t slot_count = 4);
+			~frame_tap();
+
+			// Publish every Nth frame, or only on request if zero.
+			void set_interval(uint32_t interval);
+
+			bool matches(std::string name, AVPixelFormat format, int width, int height);
+
+			void push(const AVFrame* frame);
+
+			const std::string& get_announce_path();
+
+			static bool is_supported();
+		};
+	} // namespace ipc
+} // namespace obsffmpeg
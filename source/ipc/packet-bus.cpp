@@ -0,0 +1,155 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "packet-bus.hpp"
+#include <cstring>
+#include <stdexcept>
+#include "plugin.hpp"
+
+using namespace obsffmpeg::ipc::packet_bus_layout;
+
+static size_t align(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+obsffmpeg::ipc::packet_bus::packet_bus(std::string name, std::string codec, uint32_t timebase_num,
+                                       uint32_t timebase_den, size_t data_size, uint32_t slot_count)
+    : _name(name), _header(nullptr), _slots(nullptr), _data(nullptr), _lagging(0)
+{
+	if ((slot_count == 0) || (data_size == 0))
+		throw std::invalid_argument("bus must not be empty");
+
+	size_t offset_slots = align(sizeof(header), 64);
+	size_t offset_data  = align(offset_slots + sizeof(slot) * slot_count, 4096);
+	_memory             = std::make_unique<shared_memory>(name, offset_data + align(data_size, 4096));
+
+	// The memory is zero filled, so every atomic already holds zero.
+	_header = reinterpret_cast<header*>(_memory->data());
+	_slots  = reinterpret_cast<slot*>(_memory->data() + offset_slots);
+	_data   = _memory->data() + offset_data;
+
+	_header->data_size    = _memory->size() - offset_data;
+	_header->slot_count   = slot_count;
+	_header->timebase_num = timebase_num;
+	_header->timebase_den = timebase_den;
+	strncpy(_header->codec, codec.c_str(), codec_name_length - 1);
+	_header->version = version;
+	std::atomic_thread_fence(std::memory_order_release);
+	_header->magic = magic;
+}
+
+obsffmpeg::ipc::packet_bus::~packet_bus()
+{
+	// Wake up sleeping readers so that they notice the bus is gone.
+	_header->magic = 0;
+	notify();
+}
+
+void obsffmpeg::ipc::packet_bus::notify()
+{
+	shared_memory::wake(_header->futex, _header->waiters);
+}
+
+void obsffmpeg::ipc::packet_bus::check_readers()
+{
+	// Readers are never waited for, but it helps to know when one can not keep up.
+	uint64_t sequence = _header->write_sequence.load(std::memory_order_relaxed);
+	size_t   lagging  = 0;
+	for (size_t idx = 0; idx < max_readers; idx++) {
+		reader& entry = _header->readers[idx];
+		if (entry.pid.load(std::memory_order_relaxed) == 0)
+			continue;
+		uint64_t position = entry.position.load(std::memory_order_relaxed);
+		if ((position < sequence) && ((sequence - position) > _header->slot_count))
+			lagging++;
+	}
+	if (lagging > _lagging) {
+		PLOG_WARNING("<packet bus '%s'> %zu reader(s) fell behind and are skipping packets.", _name.c_str(),
+		             lagging);
+	}
+	_lagging = lagging;
+}
+
+void obsffmpeg::ipc::packet_bus::publish(const uint8_t* data, size_t size, int64_t pts, int64_t dts,
+                                         bool keyframe, uint32_t priority)
+{
+	if (size > _header->data_size) {
+		PLOG_WARNING("<packet bus '%s'> Packet of %zu bytes is too large to publish, readers will not see it.",
+		             _name.c_str(), size);
+		return;
+	}
+
+	// Packets are stored contiguously, if one does not fit in front of the end of the ring it starts at the
+	// beginning again.
+	uint64_t offset = _header->write_offset.load(std::memory_order_relaxed);
+	uint64_t pos    = offset % _header->data_size;
+	if ((pos + size) > _header->data_size)
+		offset += _header->data_size - pos;
+
+	uint64_t n     = _header->write_sequence.load(std::memory_order_relaxed);
+	slot&    entry = _slots[n % _header->slot_count];
+
+	// Readers check the write offset after copying, so it has to move before the old data is overwritten.
+	entry.sequence.store(n * 2 + 1, std::memory_order_relaxed);
+	_header->write_offset.store(offset + size, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	std::memcpy(_data + (offset % _header->data_size), data, size);
+	entry.offset = offset;
+	entry.size   = static_cast<uint32_t>(size);
+	entry.flags  = (keyframe ? flag_keyframe : 0) | ((priority & 0xFF) << flag_priority_shift);
+	entry.pts    = pts;
+	entry.dts    = dts;
+
+	entry.sequence.store(n * 2 + 2, std::memory_order_release);
+	_header->write_sequence.store(n + 1, std::memory_order_release);
+	notify();
+
+	if ((n % _header->slot_count) == 0)
+		check_readers();
+}
+
+void obsffmpeg::ipc::packet_bus::publish_extradata(const uint8_t* data, size_t size)
+{
+	if (size > max_extradata) {
+		PLOG_WARNING("<packet bus '%s'> Extra data of %zu bytes is too large to publish.", _name.c_str(), size);
+		return;
+	}
+
+	uint64_t sequence = _header->extradata_sequence.load(std::memory_order_relaxed);
+	_header->extradata_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(_header->extradata, data, size);
+	_header->extradata_size = static_cast<uint32_t>(size);
+	_header->extradata_sequence.store(sequence + 2, std::memory_order_release);
+	notify();
+}
+
+const std::string& obsffmpeg::ipc::packet_bus::get_announce_path()
+{
+	return _memory->get_announce_path();
+}
+
+bool obsffmpeg::ipc::packet_bus::is_supported()
+{
+	return shared_memory::is_supported();
+}
@@ -0,0 +1,123 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "shared-memory.hpp"
+
+namespace obsffmpeg {
+	namespace ipc {
+		// Memory layout of a packet bus. The memory starts with a header, followed by the slot index and
+		// then the packet data ring. Readers find the memory as described for shared_memory.
+		//
+		// Reading packet n:
+		// 1. Wait until header.write_sequence > n. Readers may sleep with FUTEX_WAIT on header.futex
+		//    while holding header.waiters raised.
+		// 2. If header.write_sequence - n > slot_count, the reader fell behind and has to continue with a
+		//    newer packet, preferably the next key-frame.
+		// 3. Slot n % slot_count describes packet n while its sequence is 2 * n + 2. Read the packet data
+		//    at offset % data_size, then check the slot sequence again and that
+		//    header.write_offset - offset <= data_size still holds. If not, the packet was overwritten
+		//    while it was read and has to be skipped.
+		// 4. Store n + 1 in the readers own entry in header.readers.
+		// Extra data uses header.extradata_sequence the same way, which is odd while it is updated.
+		namespace packet_bus_layout {
+			constexpr uint32_t magic   = 0x4250464F; // "OFPB"
+			constexpr uint32_t version = 1;
+
+			constexpr size_t max_readers       = 16;
+			constexpr size_t max_extradata     = 4096;
+			constexpr size_t codec_name_length = 32;
+
+			constexpr uint32_t flag_keyframe       = 1;
+			constexpr uint32_t flag_priority_shift = 8; // OBS packet priority in bits 8 to 15.
+
+			struct reader {
+				std::atomic<uint32_t> pid; // Zero if the entry is free.
+				uint32_t              reserved;
+				std::atomic<uint64_t> position; // Next packet the reader is going to read.
+			};
+
+			struct header {
+				uint32_t magic;
+				uint32_t version;
+				uint64_t data_size;
+				uint32_t slot_count;
+				uint32_t timebase_num;
+				uint32_t timebase_den;
+				char     codec[codec_name_length];
+
+				std::atomic<uint32_t> futex; // Changes on every publish.
+				std::atomic<uint32_t> waiters;
+				std::atomic<uint64_t> write_sequence;
+				std::atomic<uint64_t> write_offset;
+
+				std::atomic<uint64_t> extradata_sequence;
+				uint32_t              extradata_size;
+				uint8_t               extradata[max_extradata];
+
+				reader readers[max_readers];
+			};
+
+			struct slot {
+				std::atomic<uint64_t> sequence;
+				uint64_t              offset;
+				uint32_t              size;
+				uint32_t              flags;
+				int64_t               pts;
+				int64_t               dts;
+			};
+		} // namespace packet_bus_layout
+
+		// Publishes encoded packets into a memfd backed ring buffer, so that local processes can read
+		// the encoded stream without copies. Publishing never waits for readers, a reader that falls
+		// behind by more than the ring loses packets instead and has to catch up on its own.
+		class packet_bus {
+			std::string                    _name;
+			std::unique_ptr<shared_memory> _memory;
+			packet_bus_layout::header*     _header;
+			packet_bus_layout::slot*       _slots;
+			uint8_t*                       _data;
+			size_t                         _lagging;
+
+			void notify();
+			void check_readers();
+
+			public:
+			packet_bus(std::string name, std::string codec, uint32_t timebase_num, uint32_t timebase_den,
+			           size_t data_size = 16 * 1024 * 1024, uint32_t slot_count = 1024);
+			~packet_bus();
+
+			void publish(const uint8_t* data, size_t size, int64_t pts, int64_t dts, bool keyframe,
+			             uint32_t priority);
+
+			void publish_extradata(const uint8_t* data, size_t size);
+
+			const std::string& get_announce_path();
+
+			static bool is_supported();
+		};
+	} // namespace ipc
+} // namespace obsffmpeg
@@ -0,0 +1,193 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "shared-memory.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+obsffmpeg::ipc::shared_memory::shared_memory(std::string name, size_t size)
+    : _name(name), _fd(-1), _size(size), _memory(nullptr)
+{
+#ifdef __linux__
+	if ((name.length() == 0) || (name.find_first_of("/\\") != std::string::npos) || (name[0] == '.'))
+		throw std::invalid_argument("name must be a plain file name");
+	if (size == 0)
+		throw std::invalid_argument("size must not be zero");
+
+	_fd = static_cast<int>(syscall(SYS_memfd_create, ("obs-ffmpeg-encoder-" + name).c_str(), 0));
+	if (_fd < 0)
+		throw std::runtime_error("memfd_create failed");
+	if (ftruncate(_fd, static_cast<off_t>(_size)) != 0) {
+		close(_fd);
+		throw std::runtime_error("ftruncate failed");
+	}
+	void* memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (memory == MAP_FAILED) {
+		close(_fd);
+		throw std::runtime_error("mmap failed");
+	}
+	_memory = reinterpret_cast<uint8_t*>(memory);
+
+	try {
+		announce();
+	} catch (...) {
+		munmap(_memory, _size);
+		close(_fd);
+		throw;
+	}
+#else
+	throw std::runtime_error("shared memory is only supported on Linux");
+#endif
+}
+
+obsffmpeg::ipc::shared_memory::~shared_memory()
+{
+#ifdef __linux__
+	// Someone may have removed the announcement and reused the name since.
+	if ((_announce_path.length() > 0) && (read_announcement(_announce_path) == get_memory_path()))
+		unlink(_announce_path.c_str());
+	if (_memory)
+		munmap(_memory, _size);
+	if (_fd >= 0)
+		close(_fd);
+#endif
+}
+
+std::string obsffmpeg::ipc::shared_memory::get_memory_path()
+{
+#ifdef __linux__
+	return "/proc/" + std::to_string(static_cast<int>(getpid())) + "/fd/" + std::to_string(_fd);
+#else
+	return std::string();
+#endif
+}
+
+std::string obsffmpeg::ipc::shared_memory::read_announcement(const std::string& path)
+{
+#ifdef __linux__
+	char  buffer[PATH_MAX] = {0};
+	FILE* file             = fopen(path.c_str(), "r");
+	if (!file)
+		return std::string();
+	bool read = (fgets(buffer, sizeof(buffer), file) != nullptr);
+	fclose(file);
+	if (!read)
+		return std::string();
+
+	std::string content = buffer;
+	while ((content.length() > 0) && (content.back() == '\n'))
+		content.pop_back();
+	return content;
+#else
+	(void)path;
+	return std::string();
+#endif
+}
+
+void obsffmpeg::ipc::shared_memory::announce()
+{
+#ifdef __linux__
+	const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+	std::string dir         = std::string(runtime_dir ? runtime_dir : "/tmp") + "/obs-ffmpeg-encoder";
+	if ((mkdir(dir.c_str(), 0700) != 0) && (errno != EEXIST))
+		throw std::runtime_error("failed to create '" + dir + "'");
+
+	// Write and link, so that readers never see a partial path and an existing announcement is never replaced.
+	std::string path = dir + "/" + _name;
+	std::string temp = path + "." + std::to_string(static_cast<int>(getpid())) + ".tmp";
+	FILE*       file = fopen(temp.c_str(), "w");
+	if (!file)
+		throw std::runtime_error("failed to create '" + temp + "'");
+	fprintf(file, "%s\n", get_memory_path().c_str());
+	bool failed = (fclose(file) != 0);
+	if (failed) {
+		unlink(temp.c_str());
+		throw std::runtime_error("failed to write '" + temp + "'");
+	}
+
+	int res = link(temp.c_str(), path.c_str());
+	if ((res != 0) && (errno == EEXIST)) {
+		// An announcement left behind by a process that is gone points at memory that no longer exists.
+		std::string existing = read_announcement(path);
+		if ((existing.length() > 0) && (access(existing.c_str(), F_OK) != 0) && (unlink(path.c_str()) == 0))
+			res = link(temp.c_str(), path.c_str());
+	}
+	int error = errno;
+	unlink(temp.c_str());
+	if ((res != 0) && (error == EEXIST))
+		throw std::runtime_error("'" + path + "' is already announced by another encoder");
+	if (res != 0)
+		throw std::runtime_error("failed to write '" + path + "'");
+	_announce_path = path;
+#endif
+}
+
+uint8_t* obsffmpeg::ipc::shared_memory::data()
+{
+	return _memory;
+}
+
+size_t obsffmpeg::ipc::shared_memory::size()
+{
+	return _size;
+}
+
+const std::string& obsffmpeg::ipc::shared_memory::get_name()
+{
+	return _name;
+}
+
+const std::string& obsffmpeg::ipc::shared_memory::get_announce_path()
+{
+	return _announce_path;
+}
+
+void obsffmpeg::ipc::shared_memory::wake(std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiters)
+{
+	futex.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+	if (waiters.load(std::memory_order_acquire) > 0)
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&futex), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+	(void)waiters;
+#endif
+}
+
+bool obsffmpeg::ipc::shared_memory::is_supported()
+{
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,66 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace obsffmpeg {
+	namespace ipc {
+		// Anonymous shared memory that other local processes can map. The memory is announced in
+		// "<runtime dir>/obs-ffmpeg-encoder/<name>", a text file holding a path like "/proc/<pid>/fd/<fd>"
+		// which readers open and map. Creation fails while a running process announces the same name, and
+		// the announcement is removed again when the memory is destroyed, unless it was replaced since.
+		class shared_memory {
+			std::string _name;
+			std::string _announce_path;
+			int         _fd;
+			size_t      _size;
+			uint8_t*    _memory;
+
+			void announce();
+
+			std::string get_memory_path();
+
+			static std::string read_announcement(const std::string& path);
+
+			public:
+			shared_memory(std::string name, size_t size);
+			~shared_memory();
+
+			uint8_t* data();
+
+			size_t size();
+
+			const std::string& get_name();
+
+			const std::string& get_announce_path();
+
+			// Changes the futex word and wakes every process sleeping on it. The system call is skipped
+			// while waiters is zero, readers raise it before they sleep.
+			static void wake(std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiters);
+
+			static bool is_supported();
+		};
+	} // namespace ipc
+} // namespace obsffmpeg
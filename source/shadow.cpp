@@ -0,0 +1,376 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "shadow.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include "ffmpeg/tools.hpp"
+#include "plugin.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/intreadwrite.h>
+#include <libavutil/pixdesc.h>
+#pragma warning(pop)
+}
+
+// One key-frame interval out of this many is sampled, which leaves the rest of the time to the encoder.
+#define SAMPLE_INTERVAL 4
+
+obsffmpeg::shadow_encoder::shadow_encoder(const AVCodec* codec, const AVCodecContext* config,
+                                          std::function<void(AVCodecContext* context)> configure,
+                                          std::function<uint64_t()>                    cpu_time)
+    : _codec(codec), _config(nullptr), _sample_size(1), _cpu_time(cpu_time), _sample(0), _sampling(false),
+      _waiting(false), _pushed(0), _waited(0), _resting(0), _primary_cpu_begin(0), _primary_frames(0),
+      _context(nullptr), _context_sample(0), _running(false), _finished(0)
+{
+	_threadpool = obsffmpeg::threadpool::get(obsffmpeg::thread_priority::BACKGROUND);
+
+	_config = avcodec_alloc_context3(codec);
+	if (!_config)
+		throw std::bad_alloc();
+
+	try {
+		ffmpeg::tools::copy_codec_config(_config, config);
+		_config->flags |= AV_CODEC_FLAG_PSNR;
+		configure(_config);
+		_sample_size = std::max(_config->gop_size, 1);
+
+		_packet = std::shared_ptr<AVPacket>(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+		if (!_packet)
+			throw std::bad_alloc();
+
+		// The context opened to check the candidate encodes the first sample.
+		open_context();
+		_context_sample = 1;
+	} catch (...) {
+		avcodec_free_context(&_config);
+		throw;
+	}
+}
+
+obsffmpeg::shadow_encoder::~shadow_encoder()
+{
+	close_context();
+	avcodec_free_context(&_config);
+}
+
+void obsffmpeg::shadow_encoder::open_context()
+{
+	AVCodecContext* context = avcodec_alloc_context3(_codec);
+	if (!context)
+		throw std::bad_alloc();
+
+	try {
+		ffmpeg::tools::copy_codec_config(context, _config);
+
+		// Threads the codec starts must not compete with the encoder it shadows.
+		obsffmpeg::threading::thread_capture capture;
+		int                                  res = avcodec_open2(context, _codec, NULL);
+		if (res < 0)
+			throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+		_codec_threads = capture.get_threads();
+	} catch (...) {
+		avcodec_free_context(&context);
+		throw;
+	}
+	for (auto tid : _codec_threads) {
+		obsffmpeg::threading::set_priority(tid, obsffmpeg::thread_priority::BACKGROUND);
+	}
+
+	_context = context;
+}
+
+uint64_t obsffmpeg::shadow_encoder::close_context()
+{
+	if (!_context)
+		return 0;
+
+	// Codec threads exit with the context, so their time is taken while they still run.
+	uint64_t cpu_time = 0;
+	for (auto tid : _codec_threads) {
+		cpu_time += obsffmpeg::threading::get_cpu_time(tid);
+	}
+	_codec_threads.clear();
+
+	avcodec_close(_context);
+	avcodec_free_context(&_context);
+	_context_sample = 0;
+	return cpu_time;
+}
+
+bool obsffmpeg::shadow_encoder::matches(const AVCodec* codec, const AVCodecContext* config)
+{
+	return (codec == _codec) && (config->width == _config->width) && (config->height == _config->height)
+	       && (config->pix_fmt == _config->pix_fmt);
+}
+
+void obsffmpeg::shadow_encoder::drop_sample()
+{
+	// Queued frames are of no use anymore, and the worker drops what it has of the sample by itself.
+	std::unique_lock<std::mutex> ul(_lock);
+	_queue.clear();
+	_stats.skipped += static_cast<uint64_t>(_pushed);
+	_sampling = false;
+	_waiting  = false;
+	_resting  = _sample_size * (SAMPLE_INTERVAL - 1);
+}
+
+void obsffmpeg::shadow_encoder::push(std::shared_ptr<AVFrame> frame)
+{
+	auto now = std::chrono::high_resolution_clock::now();
+
+	// A sample that has all of its frames waits for the packets of both encoders.
+	if (_sampling && (_pushed >= _sample_size)) {
+		_primary.primary_cpu_time = _cpu_time() - _primary_cpu_begin;
+		_sampling                 = false;
+		_waiting                  = true;
+		_waited                   = 0;
+	}
+	if (_waiting) {
+		std::unique_lock<std::mutex> ul(_lock);
+		if ((_finished == _sample) && (_primary_frames >= _sample_size)) {
+			_stats.frames += _finished_stats.frames;
+			_stats.packets += _finished_stats.packets;
+			_stats.bytes += _finished_stats.bytes;
+			_stats.cpu_time += _finished_stats.cpu_time;
+			_stats.latency += _finished_stats.latency;
+			_stats.quality += _finished_stats.quality;
+			_stats.quality_packets += _finished_stats.quality_packets;
+			_stats.psnr += _finished_stats.psnr;
+			_stats.psnr_packets += _finished_stats.psnr_packets;
+			_stats.primary_bytes += _primary.primary_bytes;
+			_stats.primary_cpu_time += _primary.primary_cpu_time;
+			_stats.primary_latency += _primary.primary_latency;
+			_stats.primary_quality += _primary.primary_quality;
+			_stats.primary_quality_packets += _primary.primary_quality_packets;
+			_waiting = false;
+			_resting = _sample_size * (SAMPLE_INTERVAL - 1);
+		} else if ((_finished != _sample) && _running) {
+			// A candidate slower than real time is still at it, which only delays the next sample.
+			_stats.skipped++;
+			return;
+		} else if ((_finished == _sample) && (++_waited <= _sample_size)) {
+			// Lookahead of the encoder may hold back its last packets for up to a key-frame interval.
+			_stats.skipped++;
+			return;
+		} else {
+			// One of the encoders lost a frame of the sample, so the two can not be compared on it.
+			ul.unlock();
+			drop_sample();
+		}
+	}
+
+	if (!_sampling) {
+		// Samples are spread out, and the worker may still be busy with a sample that was dropped.
+		std::unique_lock<std::mutex> ul(_lock);
+		if (_running || (_resting > 0)) {
+			_resting = std::max<int64_t>(_resting - 1, 0);
+			_stats.skipped++;
+			return;
+		}
+		ul.unlock();
+
+		_sample++;
+		_sampling          = true;
+		_pushed            = 0;
+		_primary           = shadow_stats();
+		_primary_frames    = 0;
+		_primary_cpu_begin = _cpu_time();
+		_primary_offered.clear();
+	}
+
+	// The shadow only holds a reference, and the encoder allocates or copies a frame it still wants to write.
+	std::shared_ptr<AVFrame> ref = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* frame) {
+		av_frame_unref(frame);
+		av_frame_free(&frame);
+	});
+	if (!ref || (av_frame_ref(ref.get(), frame.get()) < 0)) {
+		{
+			std::unique_lock<std::mutex> ul(_lock);
+			_stats.skipped++;
+		}
+		drop_sample();
+		return;
+	}
+
+	sample_frame item;
+	item.sample  = _sample;
+	item.index   = _pushed++;
+	item.frame   = ref;
+	item.offered = now;
+	_primary_offered[frame->pts] = now;
+
+	// A sample never queues more than its own frames, as the next one waits for the worker to finish.
+	std::unique_lock<std::mutex> ul(_lock);
+	_queue.push_back(item);
+	if (!_running) {
+		_running  = true;
+		auto self = shared_from_this();
+		_threadpool->push([self]() { self->work(); });
+	}
+}
+
+void obsffmpeg::shadow_encoder::skip()
+{
+	if (_sampling)
+		drop_sample();
+
+	std::unique_lock<std::mutex> ul(_lock);
+	_stats.skipped++;
+}
+
+void obsffmpeg::shadow_encoder::compare(const AVPacket* packet)
+{
+	auto found = _primary_offered.find(packet->pts);
+	if (found == _primary_offered.end())
+		return;
+
+	auto elapsed = std::chrono::high_resolution_clock::now() - found->second;
+	_primary.primary_latency +=
+	    static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	_primary.primary_bytes += static_cast<uint64_t>(packet->size);
+
+	int      size = 0;
+	uint8_t* data = av_packet_get_side_data(const_cast<AVPacket*>(packet), AV_PKT_DATA_QUALITY_STATS, &size);
+	if (data && (size >= 4)) {
+		_primary.primary_quality += AV_RL32(data);
+		_primary.primary_quality_packets++;
+	}
+
+	_primary_offered.erase(found);
+	_primary_frames++;
+}
+
+void obsffmpeg::shadow_encoder::work()
+{
+	while (true) {
+		sample_frame item;
+		{
+			std::unique_lock<std::mutex> ul(_lock);
+			if (_queue.size() == 0) {
+				_running = false;
+				return;
+			}
+			item = _queue.front();
+			_queue.pop_front();
+		}
+
+		try {
+			encode(item);
+		} catch (const std::exception& ex) {
+			// The rest of the sample goes with the context.
+			PLOG_WARNING("Shadow encoder failed: %s", ex.what());
+			close_context();
+		}
+	}
+}
+
+void obsffmpeg::shadow_encoder::encode(sample_frame& item)
+{
+	if (item.sample != _context_sample) {
+		// Samples start on a fresh codec, and one that lost its first frame is of no use.
+		close_context();
+		if (item.index != 0)
+			return;
+		open_context();
+		_context_sample = item.sample;
+	}
+	if (item.index == 0) {
+		_partial = shadow_stats();
+		_offered.clear();
+	}
+
+	uint64_t cpu_begin = obsffmpeg::threading::get_cpu_time();
+
+	item.frame->pts      = item.index;
+	_offered[item.index] = item.offered;
+
+	int res = avcodec_send_frame(_context, item.frame.get());
+	if (res < 0)
+		throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+	receive_packets();
+
+	// The last frame of a sample drains the codec, which is then replaced for the next sample.
+	bool last = ((item.index + 1) >= _sample_size);
+	if (last) {
+		res = avcodec_send_frame(_context, nullptr);
+		if (res < 0)
+			throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+		receive_packets();
+	}
+
+	_partial.frames++;
+	_partial.cpu_time += obsffmpeg::threading::get_cpu_time() - cpu_begin;
+
+	if (last) {
+		_partial.cpu_time += close_context();
+
+		std::unique_lock<std::mutex> ul(_lock);
+		_finished       = item.sample;
+		_finished_stats = _partial;
+	}
+}
+
+void obsffmpeg::shadow_encoder::receive_packets()
+{
+	int res;
+	while ((res = avcodec_receive_packet(_context, _packet.get())) == 0) {
+		_partial.packets++;
+		_partial.bytes += static_cast<uint64_t>(_packet->size);
+
+		// Latency is measured to the packet of the same frame, which lookahead may return much later.
+		auto found = _offered.find(_packet->pts);
+		if (found != _offered.end()) {
+			auto elapsed = std::chrono::high_resolution_clock::now() - found->second;
+			_partial.latency += static_cast<uint64_t>(
+			    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			_offered.erase(found);
+		}
+
+		// Quality (4 bytes), picture type, error count, 2 reserved bytes, then one 64-bit error sum per plane.
+		int      size = 0;
+		uint8_t* data = av_packet_get_side_data(_packet.get(), AV_PKT_DATA_QUALITY_STATS, &size);
+		if (data && (size >= 8)) {
+			_partial.quality += AV_RL32(data);
+			_partial.quality_packets++;
+
+			const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(_context->pix_fmt);
+			if ((data[5] > 0) && (size >= 16) && desc) {
+				uint64_t error = AV_RL64(data + 8);
+				double_t peak  = static_cast<double_t>((1 << desc->comp[0].depth) - 1);
+				double_t mse   = static_cast<double_t>(error) / (_context->width * _context->height);
+				_partial.psnr += (mse > 0.0) ? (10.0 * log10(peak * peak / mse)) : 100.0;
+				_partial.psnr_packets++;
+			}
+		}
+		av_packet_unref(_packet.get());
+	}
+	if ((res != AVERROR(EAGAIN)) && (res != AVERROR_EOF))
+		throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+}
+
+obsffmpeg::shadow_stats obsffmpeg::shadow_encoder::get_stats()
+{
+	std::unique_lock<std::mutex> ul(_lock);
+	return _stats;
+}
@@ -0,0 +1,137 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include "threading.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#pragma warning(pop)
+}
+
+namespace obsffmpeg {
+	struct shadow_stats {
+		uint64_t frames          = 0; // Frames of complete samples, which both encoders encoded.
+		uint64_t skipped         = 0; // Frames offered outside of complete samples.
+		uint64_t packets         = 0;
+		uint64_t bytes           = 0;
+		uint64_t cpu_time        = 0;   // CPU time of the pool thread and codec threads, in nanoseconds.
+		uint64_t latency         = 0;   // Time from offering a frame until its packet, in nanoseconds.
+		uint64_t quality         = 0;   // Sum of the quality packets reported, in lambda.
+		uint64_t quality_packets = 0;   // Packets that reported a quality.
+		double_t psnr            = 0.0; // Sum of the luma PSNR packets reported, in dB.
+		uint64_t psnr_packets    = 0;   // Packets that reported a PSNR.
+
+		// The shadowed encoder on the same frames.
+		uint64_t primary_bytes           = 0;
+		uint64_t primary_cpu_time        = 0;
+		uint64_t primary_latency         = 0;
+		uint64_t primary_quality         = 0;
+		uint64_t primary_quality_packets = 0;
+	};
+
+	// Encodes samples of an encoder's frames with candidate settings on the background pool, and throws the
+	// packets away. This compares settings on real content. Each sample is one whole key-frame interval of
+	// consecutive frames on a fresh codec, so the candidate sees the frames and key-frames the encoder sees,
+	// and both are only compared on the frames of complete samples. The shadow only references the frames, and
+	// a candidate slower than real time finishes its sample late instead of losing it, which delays the next.
+	class shadow_encoder : public std::enable_shared_from_this<shadow_encoder> {
+		struct sample_frame {
+			uint64_t                                       sample = 0;
+			int64_t                                        index  = 0;
+			std::shared_ptr<AVFrame>                       frame;
+			std::chrono::high_resolution_clock::time_point offered;
+		};
+
+		std::shared_ptr<threadpool> _threadpool;
+		const AVCodec*              _codec;
+		AVCodecContext*             _config; // Candidate configuration, copied into each new context.
+		int64_t                     _sample_size;
+		std::function<uint64_t()>   _cpu_time;
+
+		// Only used by the encoder.
+		uint64_t                                                          _sample;
+		bool                                                              _sampling;
+		bool                                                              _waiting;
+		int64_t                                                           _pushed;
+		int64_t                                                           _waited;
+		int64_t                                                           _resting;
+		uint64_t                                                          _primary_cpu_begin;
+		int64_t                                                           _primary_frames;
+		shadow_stats                                                      _primary;
+		std::map<int64_t, std::chrono::high_resolution_clock::time_point> _primary_offered;
+
+		// Only used by the worker.
+		AVCodecContext*                                                   _context;
+		uint64_t                                                          _context_sample;
+		std::shared_ptr<AVPacket>                                         _packet;
+		std::set<uint64_t>                                                _codec_threads;
+		shadow_stats                                                      _partial;
+		std::map<int64_t, std::chrono::high_resolution_clock::time_point> _offered;
+
+		std::mutex               _lock;
+		bool                     _running;
+		std::deque<sample_frame> _queue;
+		uint64_t                 _finished;
+		shadow_stats             _finished_stats;
+		shadow_stats             _stats;
+
+		void     open_context();
+		uint64_t close_context();
+		void     drop_sample();
+		void     work();
+		void     encode(sample_frame& item);
+		void     receive_packets();
+
+		public:
+		// Opens a copy of the configuration, which configure then changes into the candidate. The CPU time of
+		// the encoder is only asked for while pushing frames.
+		shadow_encoder(const AVCodec* codec, const AVCodecContext* config,
+		               std::function<void(AVCodecContext* context)> configure,
+		               std::function<uint64_t()>                    cpu_time);
+		~shadow_encoder();
+
+		// Whether frames of the encoder can be pushed as they are.
+		bool matches(const AVCodec* codec, const AVCodecContext* config);
+
+		// Offers the next frame of the encoder.
+		void push(std::shared_ptr<AVFrame> frame);
+
+		// Offers no frame this time, which ends the sample in progress.
+		void skip();
+
+		// Takes a packet of the encoder before its timestamps are rescaled.
+		void compare(const AVPacket* packet);
+
+		shadow_stats get_stats();
+	};
+} // namespace obsffmpeg
@@ -0,0 +1,200 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "shedding.hpp"
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include "plugin.hpp"
+
+// An encoder is over budget above this share of its frame time, and has time to spare below the other.
+#define SHED_LOAD 0.9
+#define RESTORE_LOAD 0.6
+// Weight of each new frame in the smoothed load.
+#define LOAD_SMOOTHING 0.05
+
+// Time between decisions, and the time the previous decision must have been in effect before the next one.
+#define DECISION_INTERVAL std::chrono::seconds(1)
+#define SHED_HOLD std::chrono::seconds(2)
+#define RESTORE_HOLD std::chrono::seconds(10)
+// Encoders that stopped reporting are left out of decisions.
+#define RECORD_TIMEOUT std::chrono::seconds(1)
+
+static std::mutex                                     members_lock;
+static std::set<obsffmpeg::load_shedder*>             members;
+static std::chrono::high_resolution_clock::time_point last_decision;
+static std::chrono::high_resolution_clock::time_point last_change;
+
+obsffmpeg::load_shedder::load_shedder(const std::string& name, thread_priority priority,
+                                      std::vector<shed_level> levels)
+    : _name(name), _priority(priority), _levels(levels), _level(shed_level::NONE), _step(0),
+      _applied(shed_level::NONE), _load(0.0), _has_load(false), _last_time(0), _last_frames(0)
+{
+	std::unique_lock<std::mutex> ul(members_lock);
+	members.insert(this);
+}
+
+obsffmpeg::load_shedder::~load_shedder()
+{
+	std::unique_lock<std::mutex> ul(members_lock);
+	members.erase(this);
+}
+
+void obsffmpeg::load_shedder::record(uint64_t time_encode, uint64_t frames, std::chrono::nanoseconds interval)
+{
+	auto now = std::chrono::high_resolution_clock::now();
+
+	std::unique_lock<std::mutex> ul(members_lock);
+	if ((_last_record != std::chrono::high_resolution_clock::time_point()) && (frames > _last_frames)
+	    && (time_encode >= _last_time) && (interval.count() > 0)) {
+		double_t load = static_cast<double_t>(time_encode - _last_time) / (frames - _last_frames)
+		                / static_cast<double_t>(interval.count());
+		_load     = _has_load ? (_load + (load - _load) * LOAD_SMOOTHING) : load;
+		_has_load = true;
+	}
+	_last_time   = time_encode;
+	_last_frames = frames;
+	_last_record = now;
+
+	rebalance(now);
+}
+
+obsffmpeg::shed_level obsffmpeg::load_shedder::get_level()
+{
+	return _level;
+}
+
+void obsffmpeg::load_shedder::set_applied(shed_level level)
+{
+	std::unique_lock<std::mutex> ul(members_lock);
+	if (_applied != level) {
+		_applied    = level;
+		last_change = std::chrono::high_resolution_clock::now();
+	}
+}
+
+obsffmpeg::thread_priority obsffmpeg::load_shedder::get_priority()
+{
+	return _priority;
+}
+
+bool obsffmpeg::load_shedder::has_levels(const std::vector<shed_level>& levels)
+{
+	return _levels == levels;
+}
+
+void obsffmpeg::load_shedder::rebalance(std::chrono::high_resolution_clock::time_point now)
+{
+	if ((now - last_decision) < DECISION_INTERVAL)
+		return;
+	last_decision = now;
+
+	// The most important encoder that is over budget decides how far shedding may reach.
+	load_shedder* over     = nullptr;
+	double_t      max_load = 0.0;
+	for (auto member : members) {
+		if ((now - member->_last_record) > RECORD_TIMEOUT)
+			continue;
+		// Encoders apply most levels at their next key-frame, until then their load says nothing new.
+		if (member->_applied != member->_level)
+			return;
+		if (!member->_has_load)
+			continue;
+
+		max_load = std::max(max_load, member->_load);
+		if ((member->_load > SHED_LOAD)
+		    && (!over || (member->_priority < over->_priority)
+		        || ((member->_priority == over->_priority) && (member->_load > over->_load))))
+			over = member;
+	}
+
+	if (over) {
+		if ((now - last_change) < SHED_HOLD)
+			return;
+
+		// Work that does not change the output goes first, then the least important encoders give up more.
+		auto order = [](load_shedder* member) {
+			return std::make_tuple(member->_levels[member->_step] != shed_level::AUXILIARY,
+			                       -static_cast<int64_t>(member->_priority), member->_step);
+		};
+		load_shedder* victim = nullptr;
+		for (auto member : members) {
+			if ((member->_step >= member->_levels.size()) || (member->_priority < over->_priority))
+				continue;
+			if (!victim || (order(member) < order(victim)))
+				victim = member;
+		}
+		if (!victim)
+			return;
+
+		victim->_level = victim->_levels[victim->_step++];
+		last_change    = now;
+		PLOG_INFO("Load Shedding: '%s' needs %.0f%% of its frame time, '%s' (%s) sheds '%s'.",
+		          over->_name.c_str(), over->_load * 100.0, victim->_name.c_str(),
+		          obsffmpeg::threading::get_priority_name(victim->_priority), get_level_name(victim->_level));
+		return;
+	}
+
+	if ((max_load >= RESTORE_LOAD) || ((now - last_change) < RESTORE_HOLD))
+		return;
+
+	// Taken back in reverse order, the output of the most important encoders first.
+	auto order = [](load_shedder* member) {
+		return std::make_tuple(member->_levels[member->_step - 1] != shed_level::AUXILIARY,
+		                       -static_cast<int64_t>(member->_priority), member->_step);
+	};
+	load_shedder* winner = nullptr;
+	for (auto member : members) {
+		if (member->_step == 0)
+			continue;
+		if (!winner || (order(member) > order(winner)))
+			winner = member;
+	}
+	if (!winner)
+		return;
+
+	// Encoding every frame again doubles the load, which must not be enough to shed it again right away.
+	shed_level restored = winner->_levels[winner->_step - 1];
+	if ((restored == shed_level::DECIMATE) && winner->_has_load && ((winner->_load * 2.0) >= RESTORE_LOAD))
+		return;
+
+	winner->_step--;
+	winner->_level = (winner->_step > 0) ? winner->_levels[winner->_step - 1] : shed_level::NONE;
+	last_change    = now;
+	PLOG_INFO("Load Shedding: '%s' (%s) resumes '%s'.", winner->_name.c_str(),
+	          obsffmpeg::threading::get_priority_name(winner->_priority), get_level_name(restored));
+}
+
+const char* obsffmpeg::load_shedder::get_level_name(shed_level level)
+{
+	switch (level) {
+	case shed_level::NONE:
+		return "None";
+	case shed_level::AUXILIARY:
+		return "Auxiliary";
+	case shed_level::PRESET:
+		return "Preset";
+	case shed_level::DECIMATE:
+		return "Decimate";
+	}
+	return "Unknown";
+}
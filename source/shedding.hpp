@@ -0,0 +1,84 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "threading.hpp"
+
+namespace obsffmpeg {
+	// Work an encoder gives up while it or a more important encoder is over budget, from the least to the
+	// most noticeable.
+	enum class shed_level : int64_t {
+		NONE,
+		AUXILIARY, // Shadow encoding and thumbnails pause right away.
+		PRESET,    // The codec switches to the next faster preset at the next key-frame.
+		DECIMATE,  // The codec encodes only every other frame from the next key-frame on.
+	};
+
+	// One encoder as seen by the load shedding of the whole process. Every encoder reports how much of its
+	// frame time it spends encoding. While any of them is over budget, encoders of the same or a lower
+	// priority give up work one step at a time: work that does not change the output first, then the output
+	// of the lowest priority encoders. Steps are taken back in reverse order once every encoder has time to
+	// spare again. Decisions are made by whichever encoder reports when one is due, there is no thread.
+	class load_shedder {
+		std::string             _name;
+		thread_priority         _priority;
+		std::vector<shed_level> _levels;
+		std::atomic<shed_level> _level;
+
+		// Guarded by the lock of all encoders.
+		size_t                                         _step;
+		shed_level                                     _applied;
+		double_t                                       _load;
+		bool                                           _has_load;
+		uint64_t                                       _last_time;
+		uint64_t                                       _last_frames;
+		std::chrono::high_resolution_clock::time_point _last_record;
+
+		static void rebalance(std::chrono::high_resolution_clock::time_point now);
+
+		public:
+		// Levels are the steps this encoder may take, in order. Without any it still reports its load.
+		load_shedder(const std::string& name, thread_priority priority, std::vector<shed_level> levels);
+		~load_shedder();
+
+		// Records the running totals of encode time and frames given to the encoder, and rebalances the
+		// work of all encoders if a decision is due.
+		void record(uint64_t time_encode, uint64_t frames, std::chrono::nanoseconds interval);
+
+		shed_level get_level();
+
+		// Called once the encoder runs with the level, which holds off further decisions until then.
+		void set_applied(shed_level level);
+
+		thread_priority get_priority();
+
+		bool has_levels(const std::vector<shed_level>& levels);
+
+		public:
+		static const char* get_level_name(shed_level level);
+	};
+} // namespace obsffmpeg
@@ -0,0 +1,136 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "soak.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "plugin.hpp"
+#include "utility.hpp"
+
+#if defined(WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+obsffmpeg::memory_usage obsffmpeg::get_memory_usage()
+{
+	memory_usage usage;
+#if defined(WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		usage.resident = pmc.WorkingSetSize;
+#elif defined(__linux__)
+	// The second field of statm is the resident set size in pages.
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file) {
+		unsigned long long size = 0, resident = 0;
+		if (fscanf(file, "%llu %llu", &size, &resident) == 2)
+			usage.resident = resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+		fclose(file);
+	}
+
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+	struct mallinfo2 info = mallinfo2();
+#elif defined(__GLIBC__)
+	struct mallinfo info = mallinfo();
+#endif
+#if defined(__GLIBC__)
+	// Memory mapped chunks are returned to the system when freed, so only the heap can fragment.
+	usage.heap_used = static_cast<uint64_t>(info.uordblks) + static_cast<uint64_t>(info.hblkhd);
+	usage.heap_free = static_cast<uint64_t>(info.fordblks);
+#endif
+#endif
+	return usage;
+}
+
+obsffmpeg::soak_monitor::soak_monitor(const std::string& path, const std::string& name,
+                                      std::chrono::nanoseconds interval)
+    : _path(path), _name(name), _interval(interval), _created(std::chrono::high_resolution_clock::now()),
+      _last_sample(_created), _last_time_encode(0)
+{
+	// Room for one interval at 240 FPS, so that recording never allocates in the steady state.
+	_latencies.reserve(static_cast<size_t>(
+	    std::max<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(_interval).count(), 1) * 240));
+}
+
+obsffmpeg::soak_monitor::~soak_monitor() {}
+
+void obsffmpeg::soak_monitor::record(uint64_t time_encode)
+{
+	if (_last_time_encode != 0)
+		_latencies.push_back(time_encode - _last_time_encode);
+	_last_time_encode = time_encode;
+}
+
+bool obsffmpeg::soak_monitor::is_due()
+{
+	return (std::chrono::high_resolution_clock::now() - _last_sample) >= _interval;
+}
+
+void obsffmpeg::soak_monitor::write(const std::vector<std::pair<const char*, uint64_t>>& counters)
+{
+	auto now      = std::chrono::high_resolution_clock::now();
+	auto memory   = get_memory_usage();
+	auto quantile = [this](double_t q) {
+		if (_latencies.size() == 0)
+			return 0.0;
+		size_t idx = std::min(_latencies.size() - 1, static_cast<size_t>(q * _latencies.size()));
+		std::nth_element(_latencies.begin(), _latencies.begin() + static_cast<ptrdiff_t>(idx),
+		                 _latencies.end());
+		return static_cast<double_t>(_latencies[idx]) / 1000000.0;
+	};
+
+	// Wall clock time, so that samples of encoders that were restarted in between line up.
+	std::stringstream line;
+	line << std::fixed << std::setprecision(3);
+	line << "{\"encoder\":\"" << _name << "\"";
+	line << ",\"time\":"
+	     << std::chrono::duration<double_t>(std::chrono::system_clock::now().time_since_epoch()).count();
+	line << ",\"uptime\":" << std::chrono::duration<double_t>(now - _created).count();
+	line << ",\"resident\":" << memory.resident << ",\"heap_used\":" << memory.heap_used
+	     << ",\"heap_free\":" << memory.heap_free;
+	for (auto& kv : counters)
+		line << ",\"" << kv.first << "\":" << kv.second;
+	line << ",\"latency_p50\":" << quantile(0.5);
+	line << ",\"latency_p95\":" << quantile(0.95);
+	line << ",\"latency_p99\":" << quantile(0.99);
+	line << ",\"latency_max\":" << quantile(1.0);
+	line << "}\n";
+
+	// Several encoders share the file, so each sample goes out in a single write.
+	std::ofstream file(_path, std::ios::out | std::ios::app);
+	if (file.is_open()) {
+		std::string str = line.str();
+		file.write(str.c_str(), static_cast<std::streamsize>(str.size()));
+	} else {
+		PLOG_WARNING("[%s] Unable to write soak sample to '%s'.", _name.c_str(), _path.c_str());
+	}
+
+	_latencies.clear();
+	_last_sample = now;
+}
@@ -0,0 +1,62 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace obsffmpeg {
+	struct memory_usage {
+		uint64_t resident  = 0; // Resident set size of the process, in bytes.
+		uint64_t heap_used = 0; // Bytes handed out by the allocator, 0 if unknown.
+		uint64_t heap_free = 0; // Bytes held by the allocator but not handed out, 0 if unknown.
+	};
+
+	memory_usage get_memory_usage();
+
+	// Appends periodic health samples of one encoder to a file as JSON lines. ci/soak.js reads them after
+	// runs of many hours, and fails if memory, frame pools or latency grow over time.
+	class soak_monitor {
+		std::string                                    _path;
+		std::string                                    _name;
+		std::chrono::nanoseconds                       _interval;
+		std::chrono::high_resolution_clock::time_point _created;
+		std::chrono::high_resolution_clock::time_point _last_sample;
+		uint64_t                                       _last_time_encode;
+		std::vector<uint64_t>                          _latencies;
+
+		public:
+		soak_monitor(const std::string& path, const std::string& name, std::chrono::nanoseconds interval);
+		~soak_monitor();
+
+		// Records the latency of the previous encode call, from the running total of encode time.
+		void record(uint64_t time_encode);
+
+		bool is_due();
+
+		// Appends a sample with memory usage, latency percentiles and the given counters, and starts the
+		// next interval.
+		void write(const std::vector<std::pair<const char*, uint64_t>>& counters);
+	};
+} // namespace obsffmpeg
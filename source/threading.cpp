@@ -0,0 +1,411 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "threading.hpp"
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include "plugin.hpp"
+#include "utility.hpp"
+
+#if defined(WIN32)
+#include <windows.h>
+#include <tlhelp32.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Nice level used for recording work on Linux, live work stays at the default.
+#define ST_NICE_RECORDING 5
+
+INITIALIZER(threadpool_init)
+{
+	obsffmpeg::finalizers.push_back([]() { obsffmpeg::threadpool::finalize(); });
+};
+
+const char* obsffmpeg::threading::get_priority_name(thread_priority priority)
+{
+	switch (priority) {
+	case thread_priority::LIVE:
+		return "Live";
+	case thread_priority::RECORDING:
+		return "Recording";
+	case thread_priority::BACKGROUND:
+		return "Background";
+	}
+	return "Unknown";
+}
+
+uint64_t obsffmpeg::threading::get_thread_id()
+{
+#if defined(WIN32)
+	return GetCurrentThreadId();
+#elif defined(__linux__)
+	return static_cast<uint64_t>(syscall(SYS_gettid));
+#else
+	return 0;
+#endif
+}
+
+std::set<uint64_t> obsffmpeg::threading::enumerate_threads()
+{
+	std::set<uint64_t> threads;
+#if defined(WIN32)
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+		return threads;
+
+	THREADENTRY32 entry = {0};
+	entry.dwSize        = sizeof(THREADENTRY32);
+	DWORD process       = GetCurrentProcessId();
+	if (Thread32First(snapshot, &entry)) {
+		do {
+			if (entry.th32OwnerProcessID == process)
+				threads.insert(entry.th32ThreadID);
+		} while (Thread32Next(snapshot, &entry));
+	}
+	CloseHandle(snapshot);
+#elif defined(__linux__)
+	DIR* dir = opendir("/proc/self/task");
+	if (!dir)
+		return threads;
+
+	for (struct dirent* ent = readdir(dir); ent != nullptr; ent = readdir(dir)) {
+		if (ent->d_name[0] == '.')
+			continue;
+		threads.insert(strtoull(ent->d_name, nullptr, 10));
+	}
+	closedir(dir);
+#endif
+	return threads;
+}
+
+std::string obsffmpeg::threading::get_thread_name(uint64_t thread_id)
+{
+	std::string name;
+#if defined(WIN32)
+	// Only available from Windows 10 1607 on.
+	typedef HRESULT(WINAPI * get_thread_description_t)(HANDLE, PWSTR*);
+	static auto get_thread_description = reinterpret_cast<get_thread_description_t>(
+	    GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetThreadDescription"));
+	if (!get_thread_description)
+		return name;
+
+	HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(thread_id));
+	if (!thread)
+		return name;
+
+	PWSTR description = nullptr;
+	if (SUCCEEDED(get_thread_description(thread, &description)) && description) {
+		int size = WideCharToMultiByte(CP_UTF8, 0, description, -1, nullptr, 0, nullptr, nullptr);
+		if (size > 1) {
+			name.resize(static_cast<size_t>(size));
+			WideCharToMultiByte(CP_UTF8, 0, description, -1, &name[0], size, nullptr, nullptr);
+			name.resize(static_cast<size_t>(size - 1));
+		}
+		LocalFree(description);
+	}
+	CloseHandle(thread);
+#elif defined(__linux__)
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%llu/comm", static_cast<unsigned long long>(thread_id));
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return name;
+
+	char buffer[64] = {0};
+	if (fgets(buffer, sizeof(buffer), file)) {
+		name = buffer;
+		if (!name.empty() && (name.back() == '\n'))
+			name.pop_back();
+	}
+	fclose(file);
+#endif
+	return name;
+}
+
+static std::mutex capture_lock;
+
+obsffmpeg::threading::thread_capture::thread_capture()
+    : _lock(capture_lock), _threads(enumerate_threads()), _name(get_thread_name(get_thread_id()))
+{}
+
+obsffmpeg::threading::thread_capture::~thread_capture() {}
+
+std::set<uint64_t> obsffmpeg::threading::thread_capture::get_threads()
+{
+	std::set<uint64_t> threads;
+	for (auto tid : enumerate_threads()) {
+		if (_threads.find(tid) != _threads.end())
+			continue;
+
+		std::string name = get_thread_name(tid);
+		if ((name == _name) || (name.compare(0, 3, "av:") == 0)
+#if defined(WIN32)
+		    || name.empty()
+#endif
+		)
+			threads.insert(tid);
+	}
+	return threads;
+}
+
+bool obsffmpeg::threading::set_priority(thread_priority priority)
+{
+	return set_priority(get_thread_id(), priority);
+}
+
+bool obsffmpeg::threading::set_priority(uint64_t thread_id, thread_priority priority)
+{
+#if defined(WIN32)
+	HANDLE thread = OpenThread(THREAD_SET_INFORMATION, FALSE, static_cast<DWORD>(thread_id));
+	if (!thread)
+		return false;
+
+	int level = THREAD_PRIORITY_NORMAL;
+	switch (priority) {
+	case thread_priority::LIVE:
+		level = THREAD_PRIORITY_NORMAL;
+		break;
+	case thread_priority::RECORDING:
+		level = THREAD_PRIORITY_BELOW_NORMAL;
+		break;
+	case thread_priority::BACKGROUND:
+		level = THREAD_PRIORITY_IDLE;
+		break;
+	}
+
+	bool res = SetThreadPriority(thread, level) != FALSE;
+	CloseHandle(thread);
+	return res;
+#elif defined(__linux__)
+	pid_t tid = static_cast<pid_t>(thread_id);
+	switch (priority) {
+	case thread_priority::LIVE:
+		// Lowering the nice level again requires privileges, so live work is left as is.
+		return true;
+	case thread_priority::RECORDING:
+		return setpriority(PRIO_PROCESS, static_cast<id_t>(tid), ST_NICE_RECORDING) == 0;
+	case thread_priority::BACKGROUND: {
+		struct sched_param param = {0};
+		return sched_setscheduler(tid, SCHED_IDLE, &param) == 0;
+	}
+	}
+	return false;
+#else
+	return false;
+#endif
+}
+
+#ifdef WIN32
+static uint64_t filetime_to_ns(const FILETIME& ft)
+{
+	return ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 100;
+}
+#endif
+
+uint64_t obsffmpeg::threading::get_cpu_time()
+{
+#if defined(WIN32)
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0;
+	return filetime_to_ns(kernel) + filetime_to_ns(user);
+#elif defined(__linux__)
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+#else
+	return 0;
+#endif
+}
+
+uint64_t obsffmpeg::threading::get_cpu_time(uint64_t thread_id)
+{
+#if defined(WIN32)
+	HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(thread_id));
+	if (!thread)
+		return 0;
+
+	FILETIME creation, exit, kernel, user;
+	uint64_t res = 0;
+	if (GetThreadTimes(thread, &creation, &exit, &kernel, &user))
+		res = filetime_to_ns(kernel) + filetime_to_ns(user);
+	CloseHandle(thread);
+	return res;
+#elif defined(__linux__)
+	// The first field of schedstat is the time spent on the CPU in nanoseconds.
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%llu/schedstat", static_cast<unsigned long long>(thread_id));
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return 0;
+
+	unsigned long long res = 0;
+	if (fscanf(file, "%llu", &res) != 1)
+		res = 0;
+	fclose(file);
+	return res;
+#else
+	return 0;
+#endif
+}
+
+obsffmpeg::threading::cpu_time_scope::cpu_time_scope(std::atomic_uint64_t& counter)
+    : _counter(counter), _begin(get_cpu_time())
+{}
+
+obsffmpeg::threading::cpu_time_scope::~cpu_time_scope()
+{
+	_counter += get_cpu_time() - _begin;
+}
+
+void obsffmpeg::threadpool::work()
+{
+	threading::set_priority(_priority);
+
+	std::unique_lock<std::mutex> ulock(_lock);
+	while (!_stop) {
+		if (_tasks.size() == 0) {
+			_signal.wait(ulock, [this]() { return _stop || (_tasks.size() > 0); });
+			continue;
+		}
+
+		auto task = _tasks.front();
+		_tasks.pop_front();
+
+		ulock.unlock();
+		try {
+			task();
+		} catch (const std::exception& ex) {
+			PLOG_ERROR("Unexpected exception in worker task: %s.", ex.what());
+		} catch (...) {
+			PLOG_ERROR("Unexpected exception in worker task.");
+		}
+		ulock.lock();
+	}
+}
+
+obsffmpeg::threadpool::threadpool(thread_priority priority, size_t workers) : _priority(priority), _stop(false)
+{
+	for (size_t idx = 0; idx < workers; idx++) {
+		_workers.emplace_back(std::thread([this]() { work(); }));
+	}
+}
+
+obsffmpeg::threadpool::~threadpool()
+{
+	{
+		std::unique_lock<std::mutex> ulock(_lock);
+		_stop = true;
+	}
+	_signal.notify_all();
+
+	for (auto& worker : _workers) {
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+void obsffmpeg::threadpool::push(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> ulock(_lock);
+		_tasks.push_back(task);
+	}
+	_signal.notify_one();
+}
+
+void obsffmpeg::threadpool::execute(size_t count, size_t max_threads,
+                                    std::function<void(size_t job, size_t thread)> job)
+{
+	struct state_t {
+		std::atomic_size_t      next;
+		std::atomic_size_t      done;
+		size_t                  count;
+		std::mutex              lock;
+		std::condition_variable signal;
+	};
+
+	auto state   = std::make_shared<state_t>();
+	state->next  = 0;
+	state->done  = 0;
+	state->count = count;
+
+	// Jobs are claimed in order, so scheduling stays as close to sequential execution as possible.
+	auto runner = [state, job](size_t thread) {
+		for (size_t idx = state->next++; idx < state->count; idx = state->next++) {
+			job(idx, thread);
+			if (++state->done == state->count) {
+				std::unique_lock<std::mutex> ulock(state->lock);
+				state->signal.notify_all();
+			}
+		}
+	};
+
+	// Helpers that start after all jobs were claimed return immediately, so there is no need to wait on them.
+	size_t helpers = std::min(std::min(count, max_threads), _workers.size() + 1);
+	for (size_t thread = 1; thread < helpers; thread++) {
+		push([runner, thread]() { runner(thread); });
+	}
+	runner(0);
+
+	std::unique_lock<std::mutex> ulock(state->lock);
+	state->signal.wait(ulock, [&state]() { return state->done == state->count; });
+}
+
+size_t obsffmpeg::threadpool::get_worker_count()
+{
+	return _workers.size();
+}
+
+obsffmpeg::thread_priority obsffmpeg::threadpool::get_priority()
+{
+	return _priority;
+}
+
+static std::mutex                                                               pools_lock;
+static std::map<obsffmpeg::thread_priority, std::shared_ptr<obsffmpeg::threadpool>> pools;
+
+std::shared_ptr<obsffmpeg::threadpool> obsffmpeg::threadpool::get(thread_priority priority)
+{
+	std::unique_lock<std::mutex> ulock(pools_lock);
+	auto                         found = pools.find(priority);
+	if (found != pools.end())
+		return found->second;
+
+	size_t workers = std::thread::hardware_concurrency();
+	auto   pool    = std::make_shared<threadpool>(priority, workers > 0 ? workers : 1);
+	pools.emplace(priority, pool);
+	return pool;
+}
+
+void obsffmpeg::threadpool::finalize()
+{
+	std::unique_lock<std::mutex> ulock(pools_lock);
+	pools.clear();
+}
@@ -0,0 +1,123 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace obsffmpeg {
+	enum class thread_priority : int64_t {
+		LIVE,
+		RECORDING,
+		BACKGROUND,
+	};
+
+	namespace threading {
+		const char* get_priority_name(thread_priority priority);
+
+		// Identifier of the calling thread as used by the operating system, the TID on Linux and the thread
+		// id on Windows.
+		uint64_t get_thread_id();
+
+		// All threads currently alive in this process.
+		std::set<uint64_t> enumerate_threads();
+
+		// Name of any thread of this process, empty if it has none or is gone.
+		std::string get_thread_name(uint64_t thread_id);
+
+		bool set_priority(thread_priority priority);
+
+		bool set_priority(uint64_t thread_id, thread_priority priority);
+
+		// CPU time consumed by the calling thread, in nanoseconds.
+		uint64_t get_cpu_time();
+
+		// CPU time consumed by any thread of this process, in nanoseconds. Returns 0 if the thread is gone.
+		uint64_t get_cpu_time(uint64_t thread_id);
+
+		// Finds the threads started by the calling thread while the capture exists, like the workers of a
+		// codec that is being opened. Captures are serialized, and threads started elsewhere in the meantime
+		// are told apart by name: new threads inherit the name of the thread that started them, or get one
+		// from libavcodec. Windows only names threads on request, so unnamed threads count there too.
+		class thread_capture {
+			std::unique_lock<std::mutex> _lock;
+			std::set<uint64_t>           _threads;
+			std::string                  _name;
+
+			public:
+			thread_capture();
+			~thread_capture();
+
+			// Threads started since the capture was created.
+			std::set<uint64_t> get_threads();
+		};
+
+		// Adds the CPU time the calling thread spends inside the scope to a counter.
+		class cpu_time_scope {
+			std::atomic_uint64_t& _counter;
+			uint64_t              _begin;
+
+			public:
+			cpu_time_scope(std::atomic_uint64_t& counter);
+			~cpu_time_scope();
+		};
+	} // namespace threading
+
+	class threadpool {
+		thread_priority                   _priority;
+		std::vector<std::thread>          _workers;
+		std::deque<std::function<void()>> _tasks;
+		std::mutex                        _lock;
+		std::condition_variable           _signal;
+		bool                              _stop;
+
+		void work();
+
+		public:
+		threadpool(thread_priority priority, size_t workers);
+		~threadpool();
+
+		void push(std::function<void()> task);
+
+		// Runs jobs [0, count) on up to max_threads threads, including the calling thread, and returns
+		// once all of them have completed. The second argument passed to job is the executing thread
+		// index, which is always smaller than max_threads.
+		void execute(size_t count, size_t max_threads, std::function<void(size_t job, size_t thread)> job);
+
+		size_t get_worker_count();
+
+		thread_priority get_priority();
+
+		public:
+		static std::shared_ptr<threadpool> get(thread_priority priority);
+
+		static void finalize();
+	};
+} // namespace obsffmpeg
@@ -0,0 +1,188 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "thumbnailer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "ffmpeg/tools.hpp"
+#include "plugin.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libswscale/swscale.h>
+#pragma warning(pop)
+}
+
+#if defined(WIN32)
+#include <windows.h>
+#endif
+
+obsffmpeg::thumbnailer::thumbnailer(std::string path, uint32_t width, double_t interval)
+    : _path(path), _width(width), _busy(false), _context(nullptr)
+{
+	_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double_t>(interval));
+	_last       = std::chrono::high_resolution_clock::now() - _interval;
+	_threadpool = obsffmpeg::threadpool::get(obsffmpeg::thread_priority::BACKGROUND);
+}
+
+obsffmpeg::thumbnailer::~thumbnailer()
+{
+	if (_context) {
+		avcodec_free_context(&_context);
+	}
+}
+
+void obsffmpeg::thumbnailer::push(std::shared_ptr<AVFrame> frame)
+{
+	// Never queue up work, a thumbnail that is late is simply skipped.
+	auto now = std::chrono::high_resolution_clock::now();
+	if (_busy || ((now - _last) < _interval))
+		return;
+
+	std::shared_ptr<AVFrame> ref = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* frame) {
+		av_frame_unref(frame);
+		av_frame_free(&frame);
+	});
+	if (av_frame_ref(ref.get(), frame.get()) < 0)
+		return;
+
+	_busy = true;
+	_last = now;
+
+	auto self = shared_from_this();
+	_threadpool->push([self, ref]() {
+		try {
+			self->generate(ref);
+		} catch (const std::exception& ex) {
+			PLOG_WARNING("Failed to generate thumbnail '%s': %s", self->_path.c_str(), ex.what());
+		}
+		self->_busy = false;
+	});
+}
+
+void obsffmpeg::thumbnailer::generate(std::shared_ptr<AVFrame> frame)
+{
+	uint32_t width  = std::min<uint32_t>(_width, static_cast<uint32_t>(frame->width)) & ~1u;
+	uint32_t height = static_cast<uint32_t>(static_cast<uint64_t>(frame->height) * width / frame->width) & ~1u;
+	if ((width == 0) || (height == 0))
+		throw std::invalid_argument("frame too small");
+
+	// Scaler
+	AVColorSpace colorspace = (frame->colorspace != AVCOL_SPC_UNSPECIFIED) ? frame->colorspace : AVCOL_SPC_BT709;
+	if ((_swscale.get_source_format() != static_cast<AVPixelFormat>(frame->format))
+	    || (_swscale.get_source_width() != static_cast<uint32_t>(frame->width))
+	    || (_swscale.get_source_height() != static_cast<uint32_t>(frame->height))
+	    || (_swscale.get_target_width() != width) || (_swscale.get_source_colorspace() != colorspace)) {
+		_swscale.finalize();
+		_swscale.set_source_size(frame->width, frame->height);
+		_swscale.set_source_format(static_cast<AVPixelFormat>(frame->format));
+		_swscale.set_source_color(frame->color_range == AVCOL_RANGE_JPEG, colorspace);
+		_swscale.set_target_size(width, height);
+		_swscale.set_target_format(AV_PIX_FMT_YUVJ420P);
+		_swscale.set_target_color(true, colorspace);
+		if (!_swscale.initialize(SWS_FAST_BILINEAR))
+			throw std::runtime_error("failed to initialize scaler");
+
+		if (_context)
+			avcodec_free_context(&_context);
+		_frame.reset();
+	}
+
+	// Encoder
+	int res = 0;
+	if (!_context) {
+		const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+		if (!codec)
+			throw std::runtime_error("no JPEG encoder available");
+
+		_context                 = avcodec_alloc_context3(codec);
+		_context->width          = static_cast<int>(width);
+		_context->height         = static_cast<int>(height);
+		_context->pix_fmt        = AV_PIX_FMT_YUVJ420P;
+		_context->color_range    = AVCOL_RANGE_JPEG;
+		_context->time_base      = {1, 1};
+		_context->thread_count   = 1;
+		_context->global_quality = FF_QP2LAMBDA * 5;
+		_context->flags |= AV_CODEC_FLAG_QSCALE;
+
+		res = avcodec_open2(_context, codec, nullptr);
+		if (res < 0) {
+			avcodec_free_context(&_context);
+			throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+		}
+
+		_frame = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* frame) {
+			av_frame_unref(frame);
+			av_frame_free(&frame);
+		});
+		_frame->width  = _context->width;
+		_frame->height = _context->height;
+		_frame->format = _context->pix_fmt;
+
+		res = av_frame_get_buffer(_frame.get(), 32);
+		if (res < 0)
+			throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+	}
+
+	_swscale.convert(frame->data, frame->linesize, 0, frame->height, _frame->data, _frame->linesize);
+	frame.reset(); // The encoder can reuse its frame now.
+
+	_frame->pts     = 0;
+	_frame->quality = _context->global_quality;
+	res             = avcodec_send_frame(_context, _frame.get());
+	if (res < 0)
+		throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+
+	AVPacket* packet = av_packet_alloc();
+	res              = avcodec_receive_packet(_context, packet);
+	if (res < 0) {
+		av_packet_free(&packet);
+		throw std::runtime_error(ffmpeg::tools::get_error_description(res));
+	}
+
+	// Write to a temporary file first, so that readers never see a partial image.
+	std::string temp = _path + ".tmp";
+	bool        written;
+	{
+		std::ofstream file(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(packet->data), packet->size);
+		written = file.good();
+		file.close();
+		written = written && file.good();
+	}
+	av_packet_free(&packet);
+	if (!written) {
+		std::remove(temp.c_str());
+		throw std::runtime_error("failed to write thumbnail");
+	}
+
+	// Replacing has to happen in one step, or readers may find no file at all.
+#if defined(WIN32)
+	if (!MoveFileExA(temp.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		throw std::runtime_error("failed to replace thumbnail");
+#else
+	if (std::rename(temp.c_str(), _path.c_str()) != 0)
+		throw std::runtime_error("failed to replace thumbnail");
+#endif
+}
@@ -0,0 +1,62 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "ffmpeg/swscale.hpp"
+#include "threading.hpp"
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#pragma warning(pop)
+}
+
+namespace obsffmpeg {
+	// Periodically writes a downscaled JPEG of frames the encoder already converted. The encoder only
+	// takes a new reference to the frame, scaling and compression happen on the background pool.
+	class thumbnailer : public std::enable_shared_from_this<thumbnailer> {
+		std::string                                    _path;
+		uint32_t                                       _width;
+		std::chrono::nanoseconds                       _interval;
+		std::chrono::high_resolution_clock::time_point _last;
+		std::atomic_bool                               _busy;
+		std::shared_ptr<threadpool>                    _threadpool;
+
+		// Only used by the worker.
+		ffmpeg::swscale          _swscale;
+		AVCodecContext*          _context;
+		std::shared_ptr<AVFrame> _frame;
+
+		void generate(std::shared_ptr<AVFrame> frame);
+
+		public:
+		thumbnailer(std::string path, uint32_t width, double_t interval);
+		~thumbnailer();
+
+		void push(std::shared_ptr<AVFrame> frame);
+	};
+} // namespace obsffmpeg
@@ -0,0 +1,93 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Static tracepoints for perf, bpftrace and other tools that understand Linux SDT probes, for example:
+//   bpftrace -e 'usdt:<path to plugin>:obs_ffmpeg_encoder:packet { @size = hist(arg3); }'
+// Each probe has a semaphore, so arguments that cost something to compute, like durations, are only
+// computed while a tracer is attached. Without <sys/sdt.h> every probe compiles to nothing.
+//
+// Probes and their arguments, durations are in nanoseconds:
+//   frame(encoder, pts)                              A frame was handed to the encoder.
+//   convert_begin(encoder, pts)                      Conversion of a frame starts.
+//   convert_end(encoder, pts, duration)              Conversion of a frame finished.
+//   send_frame(encoder, pts, result, duration)       A frame was sent to the codec.
+//   receive_packet(encoder, result, duration)        A packet was requested from the codec.
+//   packet(encoder, pts, dts, size, priority)        A packet was returned to OBS.
+//   pool_miss(encoder, allocations)                  No free frame was available, so one was allocated.
+//   graphics_wait(duration)                          Time spent waiting for the graphics lock.
+//   drop(object, pts, reason)                        A frame was dropped, see trace_drop for reasons.
+#define OBSFFMPEG_TRACE_PROBES(X) \
+	X(frame)                  \
+	X(convert_begin)          \
+	X(convert_end)            \
+	X(send_frame)             \
+	X(receive_packet)         \
+	X(packet)                 \
+	X(pool_miss)              \
+	X(graphics_wait)          \
+	X(drop)
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define OBSFFMPEG_TRACE_SDT
+#endif
+#endif
+
+#ifdef OBSFFMPEG_TRACE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define OBSFFMPEG_TRACE_SEMAPHORE(name) obs_ffmpeg_encoder_##name##_semaphore
+#define OBSFFMPEG_TRACE_DECLARE(name) extern unsigned short OBSFFMPEG_TRACE_SEMAPHORE(name);
+extern "C" {
+OBSFFMPEG_TRACE_PROBES(OBSFFMPEG_TRACE_DECLARE)
+}
+#undef OBSFFMPEG_TRACE_DECLARE
+
+#define TRACE_ENABLED(name) \
+	__builtin_expect(*static_cast<volatile unsigned short*>(&OBSFFMPEG_TRACE_SEMAPHORE(name)) != 0, 0)
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(obs_ffmpeg_encoder, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(obs_ffmpeg_encoder, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(obs_ffmpeg_encoder, name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(obs_ffmpeg_encoder, name, a, b, c, d)
+#define TRACE_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(obs_ffmpeg_encoder, name, a, b, c, d, e)
+#else
+#define TRACE_ENABLED(name) false
+#define TRACE_PROBE1(name, a)
+#define TRACE_PROBE2(name, a, b)
+#define TRACE_PROBE3(name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d)
+#define TRACE_PROBE5(name, a, b, c, d, e)
+#endif
+
+namespace obsffmpeg {
+	// Reason argument of the drop probe.
+	enum class trace_drop : int {
+		DECIMATION = 1, // Skipped by the frame rate divisor.
+		BUSY       = 2, // The codec did not accept the frame, but a packet was already returned.
+		END        = 3, // The codec was already flushed.
+		FAILURE    = 4, // Sending or receiving failed.
+		STALL      = 5, // The codec did not accept the frame in time.
+		FRAME_TAP  = 6, // No free frame tap slot.
+	};
+} // namespace obsffmpeg
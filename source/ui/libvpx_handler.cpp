@@ -0,0 +1,123 @@
+// FFMPEG Video Encoder Integration for OBS Studio
+// Copyright (c) 2019 Michael Fabian Dirks <info@xaymar.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "libvpx_handler.hpp"
+#include <map>
+#include <sstream>
+#include <vector>
+#include "encoder.hpp"
+#include "ffmpeg/tools.hpp"
+#include "plugin.hpp"
+#include "strings.hpp"
+#include "utility.hpp"
+
+extern "C" {
+#include <obs-module.h>
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#include <libavutil/opt.h>
+#pragma warning(pop)
+}
+
+#define ST_TEMPORALLAYERS "LibVPX.TemporalLayers"
+#define ST_TEMPORALLAYERS_(x) ST_TEMPORALLAYERS "." D_VSTR(x)
+
+struct temporal_layering {
+	const char*           name;
+	int64_t               mode;     // ts_layering_mode of FFmpeg's libvpx wrapper.
+	std::vector<int64_t>  bitrates; // Share of the total bitrate up to and including each layer, in percent.
+	std::vector<uint32_t> pattern;  // Layer of each frame in one period.
+};
+
+static std::map<int64_t, temporal_layering> layerings{
+    {2, {ST_TEMPORALLAYERS_(Two), 2, {60, 100}, {0, 1}}},
+    {3, {ST_TEMPORALLAYERS_(Three), 3, {40, 60, 100}, {0, 2, 1, 2}}},
+};
+
+INITIALIZER(libvpx_handler_init)
+{
+	obsffmpeg::initializers.push_back([]() {
+		obsffmpeg::register_codec_handler("libvpx", std::make_shared<obsffmpeg::ui::libvpx_handler>());
+	});
+};
+
+void obsffmpeg::ui::libvpx_handler::get_defaults(obs_data_t* settings, const AVCodec*, AVCodecContext*, bool)
+{
+	obs_data_set_default_int(settings, ST_TEMPORALLAYERS, 1);
+}
+
+void obsffmpeg::ui::libvpx_handler::get_properties(obs_properties_t* props, const AVCodec*, AVCodecContext* context,
+                                                   bool)
+{
+	if (!context) {
+		auto p = obs_properties_add_list(props, ST_TEMPORALLAYERS, TRANSLATE(ST_TEMPORALLAYERS),
+		                                 OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+		obs_property_set_long_description(p, TRANSLATE(DESC(ST_TEMPORALLAYERS)));
+		obs_property_list_add_int(p, TRANSLATE(S_STATE_DISABLED), 1);
+		for (auto kv : layerings) {
+			obs_property_list_add_int(p, TRANSLATE(kv.second.name), kv.first);
+		}
+	} else {
+		obs_property_set_enabled(obs_properties_get(props, ST_TEMPORALLAYERS), false);
+	}
+}
+
+void obsffmpeg::ui::libvpx_handler::override_update(obsffmpeg::encoder* instance, obs_data_t* settings)
+{
+	AVCodecContext* context = const_cast<AVCodecContext*>(instance->get_avcodeccontext());
+
+	auto found = layerings.find(obs_data_get_int(settings, ST_TEMPORALLAYERS));
+	if (found == layerings.end())
+		return;
+
+	if (!av_opt_find(context->priv_data, "ts-parameters", nullptr, 0, 0)) {
+		PLOG_WARNING("[%s] Temporal layers require a newer FFmpeg, ignoring.", context->codec->name);
+		return;
+	}
+	if (context->bit_rate <= 0) {
+		PLOG_WARNING("[%s] Temporal layers require a target bitrate, ignoring.", context->codec->name);
+		return;
+	}
+
+	// Per layer bitrates are cumulative and in kbit/s.
+	std::stringstream sstr;
+	sstr << "ts_layering_mode=" << found->second.mode << ":ts_target_bitrate=";
+	for (size_t idx = 0; idx < found->second.bitrates.size(); idx++) {
+		if (idx > 0)
+			sstr << ",";
+		sstr << (context->bit_rate * found->second.bitrates[idx] / 100 / 1000);
+	}
+
+	int res = av_opt_set(context->priv_data, "ts-parameters", sstr.str().c_str(), 0);
+	if (res < 0) {
+		PLOG_WARNING("[%s] Failed to enable temporal layers: %s", context->codec->name,
+		             ffmpeg::tools::get_error_description(res));
+		return;
+	}
+
+	instance->set_temporal_pattern(found->second.pattern);
+}
+
+void obsffmpeg::ui::libvpx_handler::log_options(obs_data_t* settings, const AVCodec* codec, AVCodecContext*)
+{
+	PLOG_INFO("[%s]   LibVPX:", codec->name);
+	PLOG_INFO("[%s]     Temporal Layers: %lli", codec->name, obs_data_get_int(settings, ST_TEMPORALLAYERS));
+}
@@ -21,6 +21,8 @@
 
 #pragma once
 
+#include <chrono>
+#include "trace.hpp"
 #include "version.hpp"
 
 extern "C" {
@@ -91,7 +93,16 @@ namespace obsffmpeg {
 	struct obs_graphics {
 		obs_graphics()
 		{
+			if (!TRACE_ENABLED(graphics_wait)) {
+				obs_enter_graphics();
+				return;
+			}
+
+			auto begin = std::chrono::high_resolution_clock::now();
 			obs_enter_graphics();
+			TRACE_PROBE1(graphics_wait, std::chrono::duration_cast<std::chrono::nanoseconds>(
+			                                std::chrono::high_resolution_clock::now() - begin)
+			                                .count());
 		}
 		~obs_graphics()
 		{